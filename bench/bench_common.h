@@ -0,0 +1,108 @@
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <fstream>
+#include <map>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include <unistd.h>
+
+#include <Poco/Format.h>
+
+
+namespace bench {
+    using Clock = std::chrono::steady_clock;
+
+    inline double SecondsSince(Clock::time_point start) {
+        return std::chrono::duration<double>(Clock::now() - start).count();
+    }
+
+    // Keeps the compiler from dropping a computation whose result is unused.
+    template <class T>
+    inline void KeepAlive(const T& value) {
+        asm volatile("" : : "g"(&value) : "memory");
+    }
+
+    // Calls body(iteration) in growing rounds until one takes at least min_seconds, returns nanoseconds per call.
+    template <class Body>
+    double NanosecondsPerCall(Body&& body, double min_seconds = 0.5) {
+        size_t iterations = 1;
+        while (true) {
+            auto start = Clock::now();
+            for (size_t iteration = 0; iteration < iterations; ++iteration) {
+                body(iteration);
+            }
+            double elapsed = SecondsSince(start);
+            if (elapsed >= min_seconds) {
+                return elapsed * 1e9 / static_cast<double>(iterations);
+            }
+            iterations = elapsed < 1e-3 ? iterations * 10 :
+                    static_cast<size_t>(static_cast<double>(iterations) * min_seconds * 1.2 / elapsed) + 1;
+        }
+    }
+
+    struct LatencySummary {
+        double mean;
+        double p50;
+        double p99;
+        double p999;
+        double max;
+    };
+
+    // Summary of latencies in microseconds, sorts them in place.
+    inline LatencySummary Summarize(std::vector<double>& latencies) {
+        if (latencies.empty()) {
+            return {0, 0, 0, 0, 0};
+        }
+        std::sort(latencies.begin(), latencies.end());
+        double sum = 0;
+        for (double latency: latencies) {
+            sum += latency;
+        }
+        auto percentile = [&latencies](double fraction) {
+            auto index = static_cast<size_t>(fraction * static_cast<double>(latencies.size() - 1) + 0.5);
+            return latencies[index];
+        };
+        return {sum / static_cast<double>(latencies.size()), percentile(0.5), percentile(0.99), percentile(0.999),
+                latencies.back()};
+    }
+
+    inline size_t ResidentBytes() {
+        std::ifstream statm("/proc/self/statm");
+        size_t total_pages = 0, resident_pages = 0;
+        statm >> total_pages >> resident_pages;
+        return resident_pages * static_cast<size_t>(sysconf(_SC_PAGESIZE));
+    }
+
+    // Options given as --name=value after the command name.
+    class Options {
+    public:
+        Options(int argc, char** argv, int first) {
+            for (int index = first; index < argc; ++index) {
+                std::string option = argv[index];
+                size_t equals = option.find('=');
+                if (option.compare(0, 2, "--") != 0 || equals == std::string::npos) {
+                    throw std::runtime_error(Poco::format("Option \"%s\" is not of form --name=value", option));
+                }
+                values_[option.substr(2, equals - 2)] = option.substr(equals + 1);
+            }
+        }
+
+        [[nodiscard]] std::string Get(const std::string& name, const std::string& default_value) const {
+            auto value = values_.find(name);
+            return value == values_.end() ? default_value : value->second;
+        }
+
+        [[nodiscard]] uint64_t GetUnsigned(const std::string& name, uint64_t default_value) const {
+            auto value = values_.find(name);
+            return value == values_.end() ? default_value : std::stoull(value->second);
+        }
+
+    private:
+        std::map<std::string, std::string> values_;
+    };
+}
@@ -0,0 +1,123 @@
+#pragma once
+
+#include <atomic>
+#include <cstdio>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <Poco/NullStream.h>
+#include <Poco/StreamCopier.h>
+#include <Poco/Net/HTTPClientSession.h>
+#include <Poco/Net/HTTPRequest.h>
+#include <Poco/Net/HTTPResponse.h>
+
+#include "bench_common.h"
+#include "synthetic.h"
+
+
+// Closed loop load on /correct of a running server: every connection sends its next request as soon as the response
+// to the previous one is read. Queries misspell words of the dictionary made by "generate" with the same options.
+namespace load_generator {
+    // Request bodies are prepared in advance, so the client spends its time on the network and not on JSON.
+    inline std::vector<std::string> MakeBodies(const std::vector<SearchQuery>& queries, size_t batch_size) {
+        std::vector<std::string> bodies;
+        for (size_t begin = 0; begin < queries.size(); begin += batch_size) {
+            std::string body = "[";
+            for (size_t index = begin; index < std::min(queries.size(), begin + batch_size); ++index) {
+                if (index != begin) {
+                    body += ',';
+                }
+                // synthetic words are letters only and need no escaping
+                body += Poco::format(R"({"candidate":"%s","max_tolerance":%u})", utf8::Encode(queries[index].word),
+                        queries[index].tolerance);
+            }
+            body += ']';
+            bodies.push_back(std::move(body));
+        }
+        return bodies;
+    }
+
+    struct ConnectionResult {
+        std::vector<double> latencies;
+        size_t overloaded = 0;
+        size_t errors = 0;
+    };
+
+    inline void RunConnection(const std::string& host, uint16_t port, const std::vector<std::string>& bodies,
+            size_t first_body, bench::Clock::time_point end_time, ConnectionResult& result) {
+        Poco::Net::HTTPClientSession session(host, port);
+        session.setKeepAlive(true);
+        Poco::NullOutputStream discard;
+        for (size_t index = first_body; bench::Clock::now() < end_time; ++index) {
+            const std::string& body = bodies[index % bodies.size()];
+            auto start = bench::Clock::now();
+            try {
+                Poco::Net::HTTPRequest request(Poco::Net::HTTPRequest::HTTP_POST, "/correct",
+                        Poco::Net::HTTPMessage::HTTP_1_1);
+                request.setContentType("application/json");
+                request.setContentLength(static_cast<std::streamsize>(body.size()));
+                request.setKeepAlive(true);
+                session.sendRequest(request) << body;
+                Poco::Net::HTTPResponse response;
+                Poco::StreamCopier::copyStream(session.receiveResponse(response), discard);
+                if (response.getStatus() == Poco::Net::HTTPResponse::HTTP_SERVICE_UNAVAILABLE) {
+                    ++result.overloaded;
+                } else if (response.getStatus() != Poco::Net::HTTPResponse::HTTP_OK) {
+                    ++result.errors;
+                } else {
+                    result.latencies.push_back(bench::SecondsSince(start) * 1e6);
+                }
+            } catch (const Poco::Exception&) {
+                ++result.errors;
+                session.reset();
+            }
+        }
+    }
+
+    inline void Run(const bench::Options& options) {
+        auto script = synthetic::GetScript(options.Get("script", "latin"));
+        uint64_t seed = options.GetUnsigned("seed", 1);
+        std::string host = options.Get("host", "127.0.0.1");
+        auto port = static_cast<uint16_t>(options.GetUnsigned("port", 9000));
+        size_t connections = std::max<uint64_t>(1, options.GetUnsigned("connections", 16));
+        size_t batch_size = std::max<uint64_t>(1, options.GetUnsigned("batch", 1));
+        auto tolerance = static_cast<uint32_t>(options.GetUnsigned("tolerance", 1));
+        double duration = static_cast<double>(options.GetUnsigned("seconds", 10));
+
+        auto words = synthetic::GenerateDictionary(options.GetUnsigned("words", 1000000), script, seed);
+        auto queries = synthetic::GenerateQueries(words, options.GetUnsigned("queries", 100000), tolerance, script,
+                seed + 3 + tolerance);
+        auto bodies = MakeBodies(queries, batch_size);
+
+        std::vector<ConnectionResult> results(connections);
+        std::vector<std::thread> threads;
+        auto start = bench::Clock::now();
+        auto end_time = start + std::chrono::duration_cast<bench::Clock::duration>(
+                std::chrono::duration<double>(duration));
+        for (size_t connection = 0; connection < connections; ++connection) {
+            threads.emplace_back(RunConnection, std::cref(host), port, std::cref(bodies),
+                    connection * bodies.size() / connections, end_time, std::ref(results[connection]));
+        }
+        for (auto& thread: threads) {
+            thread.join();
+        }
+        double seconds = bench::SecondsSince(start);
+
+        std::vector<double> latencies;
+        size_t overloaded = 0, errors = 0;
+        for (const auto& result: results) {
+            latencies.insert(latencies.end(), result.latencies.begin(), result.latencies.end());
+            overloaded += result.overloaded;
+            errors += result.errors;
+        }
+        auto requests = static_cast<double>(latencies.size());
+        auto summary = bench::Summarize(latencies);
+        std::printf("%zu connections, batch %zu, tolerance %u: %.0f requests/s, %.0f queries/s, "
+                "%zu overloaded, %zu errors\n", connections, batch_size, tolerance, requests / seconds,
+                requests * static_cast<double>(batch_size) / seconds, overloaded, errors);
+        std::printf("request latency: mean %.1f us, p50 %.1f us, p99 %.1f us, p999 %.1f us, max %.1f us\n",
+                summary.mean, summary.p50, summary.p99, summary.p999, summary.max);
+    }
+}
@@ -0,0 +1,143 @@
+#pragma once
+
+#include <cstdio>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <sys/stat.h>
+
+#include "bench_common.h"
+#include "sharded_dictionary.h"
+#include "symspell_index.h"
+#include "synthetic.h"
+#include "thread_pool.h"
+
+
+// Whole tree benchmarks: build time, memory per word, latency of single queries and throughput of batches
+// for tolerances from 0 to 3, of one tree or of a sharded dictionary.
+namespace macro {
+    constexpr uint32_t kMaxTolerance = 3;
+    constexpr size_t kChunkSize = 32;
+
+    inline size_t FileSize(const std::string& file_name) {
+        struct stat file_stat{};
+        if (stat(file_name.c_str(), &file_stat) != 0) {
+            throw std::runtime_error(Poco::format("Can't stat file \"%s\"", file_name));
+        }
+        return static_cast<size_t>(file_stat.st_size);
+    }
+
+    inline std::vector<std::unique_ptr<BKTree>> Build(const std::string& dictionary_file_name, size_t threads_count,
+            size_t shards_count, size_t words_count) {
+        auto start = bench::Clock::now();
+        auto metric = std::make_shared<LevensteinMetric>();
+        std::vector<std::unique_ptr<BKTree>> trees;
+        if (shards_count == 1) {
+            trees.push_back(std::make_unique<BKTree>(dictionary_file_name, metric, threads_count));
+        } else {
+            trees = ShardedDictionary::Build(dictionary_file_name, metric, shards_count, threads_count);
+        }
+        double seconds = bench::SecondsSince(start);
+        std::printf("build of %zu shards on %2zu threads: %8.3f s, %8.0f words/s\n", shards_count, threads_count,
+                seconds, static_cast<double>(words_count) / seconds);
+        return trees;
+    }
+
+    inline void BenchmarkLatency(const Dictionary& dictionary, const std::vector<SearchQuery>& queries) {
+        std::vector<double> latencies;
+        latencies.reserve(queries.size());
+        size_t found = 0;
+        for (const SearchQuery& query: queries) {
+            auto start = bench::Clock::now();
+            auto results = dictionary.FindSimilar(query.word, query.tolerance, query.limit);
+            latencies.push_back(bench::SecondsSince(start) * 1e6);
+            found += !results.empty();
+        }
+        auto summary = bench::Summarize(latencies);
+        std::printf("tolerance %u latency: mean %8.1f us, p50 %8.1f us, p99 %8.1f us, p999 %8.1f us, "
+                "max %8.1f us, found %5.1f%%\n", queries.front().tolerance, summary.mean, summary.p50, summary.p99,
+                summary.p999, summary.max, 100.0 * static_cast<double>(found) / static_cast<double>(queries.size()));
+    }
+
+    // Chunks of the batch are searched by the pool as SearchExecutor does for /correct.
+    inline void BenchmarkThroughput(const Dictionary& dictionary, const std::vector<SearchQuery>& queries,
+            ThreadPool& pool, size_t threads_count) {
+        auto start = bench::Clock::now();
+        pool.ParallelFor(queries.size(), kChunkSize, [&](size_t begin, size_t end) {
+            std::vector<SearchQuery> chunk(queries.begin() + begin, queries.begin() + end);
+            bench::KeepAlive(dictionary.FindSimilar(chunk));
+        });
+        double seconds = bench::SecondsSince(start);
+        std::printf("tolerance %u throughput on %2zu threads: %10.0f queries/s\n", queries.front().tolerance,
+                threads_count, static_cast<double>(queries.size()) / seconds);
+    }
+
+    inline void Run(const bench::Options& options) {
+        auto script = synthetic::GetScript(options.Get("script", "latin"));
+        uint64_t seed = options.GetUnsigned("seed", 1);
+        size_t words_count = options.GetUnsigned("words", 1000000);
+        size_t queries_count = options.GetUnsigned("queries", 10000);
+        size_t threads_count = options.GetUnsigned("threads", std::max(1u, std::thread::hardware_concurrency()));
+        std::string dictionary_file_name = options.Get("dictionary", "corrector_bench_dictionary.txt");
+        std::string index_file_name = options.Get("index", "corrector_bench_index.bin");
+        size_t shards_count = std::max<uint64_t>(1, options.GetUnsigned("shards", 1));
+
+        std::string engine = options.Get("engine", "bktree");
+        if (engine != "bktree" && engine != "symspell") {
+            throw std::runtime_error(Poco::format("Unknown engine \"%s\", expected bktree or symspell", engine));
+        }
+
+        auto words = synthetic::GenerateDictionary(words_count, script, seed);
+        synthetic::WriteDictionary(words, dictionary_file_name);
+
+        if (threads_count > 1) {
+            Build(dictionary_file_name, 1, shards_count, words_count).clear();
+        }
+        auto pool = std::make_shared<ThreadPool>(threads_count);
+        size_t resident_before = bench::ResidentBytes();
+        auto trees = Build(dictionary_file_name, threads_count, shards_count, words_count);
+        size_t index_size = 0;
+        if (shards_count == 1) {
+            trees.front()->SaveIndex(index_file_name);
+            index_size = FileSize(index_file_name);
+        } else {
+            ShardedDictionary::SaveIndex(trees, index_file_name);
+            for (size_t shard = 0; shard < trees.size(); ++shard) {
+                index_size += FileSize(ShardedDictionary::ShardFileName(index_file_name, shard));
+            }
+        }
+        ShardedDictionary::Shards shards;
+        auto start = bench::Clock::now();
+        for (auto& tree: trees) {
+            if (engine == "symspell") {
+                shards.push_back(std::make_unique<SymSpellIndex>(std::move(tree),
+                        options.GetUnsigned("symspell_max_distance", 2)));
+            } else {
+                shards.push_back(std::move(tree));
+            }
+        }
+        if (engine == "symspell") {
+            std::printf("symmetric delete index: %8.3f s\n", bench::SecondsSince(start));
+        }
+        std::unique_ptr<Dictionary> dictionary;
+        if (shards.size() == 1) {
+            dictionary = std::move(shards.front());
+        } else {
+            dictionary = std::make_unique<ShardedDictionary>(std::move(shards), pool);
+        }
+        size_t resident_after = bench::ResidentBytes();
+        // the resident delta is approximate, freed memory the allocator keeps is counted as used
+        std::printf("memory per word: index file %6.1f bytes, resident %6.1f bytes\n",
+                static_cast<double>(index_size) / static_cast<double>(words_count),
+                static_cast<double>(resident_after - std::min(resident_before, resident_after))
+                        / static_cast<double>(words_count));
+
+        for (uint32_t tolerance = 0; tolerance <= kMaxTolerance; ++tolerance) {
+            auto queries = synthetic::GenerateQueries(words, queries_count, tolerance, script, seed + 3 + tolerance);
+            BenchmarkLatency(*dictionary, queries);
+            BenchmarkThroughput(*dictionary, queries, *pool, threads_count);
+        }
+    }
+}
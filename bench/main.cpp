@@ -0,0 +1,58 @@
+#include <iostream>
+#include <string>
+
+#include "bench_common.h"
+#include "synthetic.h"
+#include "micro.h"
+#include "macro.h"
+#include "load_generator.h"
+
+
+namespace {
+    constexpr const char* kUsage =
+        "Usage: corrector_bench <command> [--name=value...]\n"
+        "Commands:\n"
+        "  generate  write a synthetic dictionary: --words --script=latin|cyrillic --seed --dictionary\n"
+        "  micro     time distance kernels: --words --script --seed --min_milliseconds --metric_config\n"
+        "  macro     time tree build and searches at tolerances 0-3: --words --queries --threads --script --seed\n"
+        "            --dictionary --index --engine=bktree|symspell --symspell_max_distance --shards\n"
+        "  load      closed loop load on /correct of a running server: --host --port --connections --seconds\n"
+        "            --batch --tolerance --queries, and --words --script --seed of its dictionary\n";
+
+    void Generate(const bench::Options& options) {
+        auto script = synthetic::GetScript(options.Get("script", "latin"));
+        size_t words_count = options.GetUnsigned("words", 1000000);
+        std::string dictionary_file_name = options.Get("dictionary", "corrector_bench_dictionary.txt");
+        std::cerr << Poco::format("Writing %z words to %s... ", words_count, dictionary_file_name);
+        synthetic::WriteDictionary(synthetic::GenerateDictionary(words_count, script, options.GetUnsigned("seed", 1)),
+                dictionary_file_name);
+        std::cerr << "Done!" << std::endl;
+    }
+}
+
+int main(int argc, char** argv) {
+    if (argc < 2) {
+        std::cerr << kUsage;
+        return 1;
+    }
+    std::string command = argv[1];
+    try {
+        bench::Options options(argc, argv, 2);
+        if (command == "generate") {
+            Generate(options);
+        } else if (command == "micro") {
+            micro::Run(options);
+        } else if (command == "macro") {
+            macro::Run(options);
+        } else if (command == "load") {
+            load_generator::Run(options);
+        } else {
+            std::cerr << kUsage;
+            return 1;
+        }
+    } catch (const std::exception& error) {
+        std::cerr << error.what() << std::endl;
+        return 1;
+    }
+    return 0;
+}
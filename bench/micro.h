@@ -0,0 +1,129 @@
+#pragma once
+
+#include <cstdio>
+#include <functional>
+#include <memory>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "bench_common.h"
+#include "synthetic.h"
+
+
+// Nanoseconds per call of every distance kernel on pairs of similar words (a word and its misspelling) and of
+// unrelated ones, which is what the tree mostly compares near the root.
+namespace micro {
+    constexpr size_t kPairsCount = 1 << 12;
+    constexpr size_t kBatchSize = 64;
+
+    struct Pairs {
+        std::vector<std::wstring> left;
+        std::vector<std::wstring> right;
+        std::vector<std::wstring_view> right_views;
+    };
+
+    inline Pairs MakePairs(const DictionaryEntries& words, const synthetic::Script& script, bool is_similar,
+            uint64_t seed) {
+        std::mt19937_64 random(seed);
+        synthetic::TypoModel typo_model(script, seed + 1);
+        // pairs of a batch share the left word, so batch kernels compare one query with its misspellings too
+        Pairs pairs;
+        for (size_t index = 0; index < kPairsCount; ++index) {
+            std::wstring word = index % kBatchSize == 0 ? words[random() % words.size()].first :
+                    pairs.left.back();
+            pairs.left.push_back(word);
+            pairs.right.push_back(is_similar ? typo_model.Misspell(word, 1 + random() % 2) :
+                    words[random() % words.size()].first);
+        }
+        pairs.right_views.assign(pairs.right.begin(), pairs.right.end());
+        return pairs;
+    }
+
+    inline void Report(const std::string& kernel, const std::string& pairs_kind, double nanoseconds) {
+        std::printf("%-48s %-8s %10.1f ns/pair\n", kernel.c_str(), pairs_kind.c_str(), nanoseconds);
+    }
+
+    inline void BenchmarkMetric(const std::string& name, const AbstractWStringMetric& metric, const Pairs& pairs,
+            const std::string& pairs_kind, double min_seconds) {
+        MetricWorkspace workspace;
+        auto mask = kPairsCount - 1;
+        Report(name + " operator()", pairs_kind, bench::NanosecondsPerCall([&](size_t iteration) {
+            bench::KeepAlive(metric(pairs.left[iteration & mask], pairs.right[iteration & mask], workspace));
+        }, min_seconds));
+        for (uint32_t bound: {1u, 2u}) {
+            double nanoseconds = bench::NanosecondsPerCall([&](size_t iteration) {
+                bench::KeepAlive(metric.Bounded(pairs.left[iteration & mask], pairs.right[iteration & mask], bound,
+                        workspace));
+            }, min_seconds);
+            Report(Poco::format("%s Bounded(%u)", name, bound), pairs_kind, nanoseconds);
+        }
+        // a query against kBatchSize words, like a node of the frozen tree against its children
+        const std::vector<uint32_t> bounds(kBatchSize, 2);
+        Report(name + " QueryBatch", pairs_kind, bench::NanosecondsPerCall([&](size_t iteration) {
+            size_t first = (iteration * kBatchSize) & mask;
+            uint32_t distances[kBatchSize];
+            metric.Prepare(pairs.left[first], workspace);
+            metric.QueryBatch(pairs.right_views.data() + first, bounds.data(), kBatchSize, distances, workspace);
+            bench::KeepAlive(distances);
+        }, min_seconds) / kBatchSize);
+    }
+
+    inline void BenchmarkBitParallel(const Pairs& pairs, const std::string& pairs_kind, double min_seconds) {
+        auto mask = kPairsCount - 1;
+        // the pattern of a batch is compared with all its texts, which keeps the masks in cache as a search does
+        std::vector<PatternMasks> patterns(kPairsCount / kBatchSize);
+        for (size_t index = 0; index < patterns.size(); ++index) {
+            patterns[index].Assign(pairs.left[index * kBatchSize]);
+        }
+        Report("bit_parallel::Distance", pairs_kind, bench::NanosecondsPerCall([&](size_t iteration) {
+            size_t index = iteration & mask;
+            bench::KeepAlive(bit_parallel::Distance(patterns[index / kBatchSize], pairs.right[index]));
+        }, min_seconds));
+
+        std::vector<std::pair<std::string, bit_parallel::BatchKernel>> kernels = {
+            {"bit_parallel::DistanceBatchScalar", bit_parallel::DistanceBatchScalar}
+        };
+#ifdef BIT_PARALLEL_X86
+        __builtin_cpu_init();
+        if (__builtin_cpu_supports("sse4.2")) {
+            kernels.emplace_back("bit_parallel::DistanceBatchSse4", bit_parallel::DistanceBatchSse4);
+        }
+        if (__builtin_cpu_supports("avx2")) {
+            kernels.emplace_back("bit_parallel::DistanceBatchAvx2", bit_parallel::DistanceBatchAvx2);
+        }
+#endif
+        for (const auto& [name, kernel]: kernels) {
+            Report(name, pairs_kind, bench::NanosecondsPerCall([&](size_t iteration) {
+                size_t first = (iteration * kBatchSize) & mask;
+                uint32_t distances[kBatchSize];
+                kernel(patterns[first / kBatchSize], pairs.right_views.data() + first, kBatchSize, distances);
+                bench::KeepAlive(distances);
+            }, min_seconds) / kBatchSize);
+        }
+    }
+
+    inline void Run(const bench::Options& options) {
+        auto script = synthetic::GetScript(options.Get("script", "latin"));
+        uint64_t seed = options.GetUnsigned("seed", 1);
+        double min_seconds = static_cast<double>(options.GetUnsigned("min_milliseconds", 500)) / 1000;
+        auto words = synthetic::GenerateDictionary(options.GetUnsigned("words", 100000), script, seed);
+
+        std::unique_ptr<AbstractWStringMetric> weighted;
+        std::string metric_config = options.Get("metric_config", "");
+        if (metric_config.empty()) {
+            weighted = std::make_unique<WeightedLevensteinMetric>();
+        } else {
+            weighted = std::make_unique<WeightedLevensteinMetric>(metric_config);
+        }
+        LevensteinMetric levenstein;
+
+        for (bool is_similar: {true, false}) {
+            std::string pairs_kind = is_similar ? "similar" : "random";
+            Pairs pairs = MakePairs(words, script, is_similar, seed + 2);
+            BenchmarkMetric("LevensteinMetric", levenstein, pairs, pairs_kind, min_seconds);
+            BenchmarkMetric("WeightedLevensteinMetric", *weighted, pairs, pairs_kind, min_seconds);
+            BenchmarkBitParallel(pairs, pairs_kind, min_seconds);
+        }
+    }
+}
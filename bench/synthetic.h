@@ -0,0 +1,154 @@
+#pragma once
+
+#include <cmath>
+#include <fstream>
+#include <random>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+#include "bk_tree.hpp"
+#include "utf8.h"
+
+
+// Synthetic dictionaries and misspelled queries. Everything is derived from a seed, so runs with the same
+// parameters see the same words, priorities and typos.
+namespace synthetic {
+    struct Script {
+        std::wstring consonants;
+        std::wstring vowels;
+        // keyboard rows, neighbours of a key are next to it in its row and below or above it
+        std::vector<std::wstring> keyboard_rows;
+    };
+
+    inline Script GetScript(const std::string& name) {
+        if (name == "latin") {
+            return {L"bcdfghjklmnpqrstvwxz", L"aeiouy", {L"qwertyuiop", L"asdfghjkl", L"zxcvbnm"}};
+        }
+        if (name == "cyrillic") {
+            return {L"бвгджзклмнпрстфхцчшщ", L"аеиоуыэюя", {L"йцукенгшщзх", L"фывапролджэ", L"ячсмитьбю"}};
+        }
+        throw std::runtime_error(Poco::format("Unknown script \"%s\", expected latin or cyrillic", name));
+    }
+
+    // Pronounceable words of two to four syllables with Zipf distributed priorities: the word of rank r
+    // has priority 10^6 / r.
+    inline DictionaryEntries GenerateDictionary(size_t words_count, const Script& script, uint64_t seed) {
+        std::mt19937_64 random(seed);
+        auto pick = [&random](const std::wstring& letters) {
+            return letters[random() % letters.size()];
+        };
+        std::unordered_set<std::wstring> seen;
+        DictionaryEntries words;
+        words.reserve(words_count);
+        while (words.size() < words_count) {
+            std::wstring word;
+            size_t syllables = 2 + random() % 3;
+            for (size_t syllable = 0; syllable < syllables; ++syllable) {
+                word += pick(script.consonants);
+                word += pick(script.vowels);
+                if (random() % 10 < 3) {
+                    word += pick(script.consonants);
+                }
+            }
+            if (seen.insert(word).second) {
+                auto priority = static_cast<uint32_t>(std::max(1.0, 1e6 / static_cast<double>(words.size() + 1)));
+                words.emplace_back(std::move(word), priority);
+            }
+        }
+        return words;
+    }
+
+    inline void WriteDictionary(const DictionaryEntries& words, const std::string& file_name) {
+        std::ofstream output(file_name, std::ios::binary | std::ios::trunc);
+        if (!output) {
+            throw std::runtime_error(Poco::format("Dictionary file \"%s\" can't be created", file_name));
+        }
+        for (const auto& [word, priority]: words) {
+            output << utf8::Encode(word) << ' ' << priority << '\n';
+        }
+    }
+
+    // Typos of a person typing fast: a key next to the right one, a missed or doubled key, swapped neighbours.
+    class TypoModel {
+    public:
+        TypoModel(const Script& script, uint64_t seed) : random_(seed) {
+            for (size_t row = 0; row < script.keyboard_rows.size(); ++row) {
+                const std::wstring& keys = script.keyboard_rows[row];
+                for (size_t column = 0; column < keys.size(); ++column) {
+                    std::wstring& neighbours = neighbours_[keys[column]];
+                    if (column > 0) {
+                        neighbours += keys[column - 1];
+                    }
+                    if (column + 1 < keys.size()) {
+                        neighbours += keys[column + 1];
+                    }
+                    // row - 1 wraps around for the first row and is skipped as well
+                    for (size_t other_row: {row - 1, row + 1}) {
+                        if (other_row < script.keyboard_rows.size()
+                                && column < script.keyboard_rows[other_row].size()) {
+                            neighbours += script.keyboard_rows[other_row][column];
+                        }
+                    }
+                }
+            }
+        }
+
+        // Number of typos in a query searched with the tolerance: mostly one, rarely more.
+        uint32_t TyposFor(uint32_t tolerance) {
+            static constexpr uint32_t kWeights[] = {30, 50, 15, 5};
+            std::discrete_distribution<uint32_t> distribution(std::begin(kWeights), std::end(kWeights));
+            return std::min(tolerance, distribution(random_));
+        }
+
+        std::wstring Misspell(std::wstring word, uint32_t typos) {
+            for (uint32_t typo = 0; typo < typos && word.size() > 1; ++typo) {
+                size_t position = random_() % word.size();
+                uint32_t kind = random_() % 100;
+                if (kind < 45) {
+                    word[position] = neighbour(word[position]);
+                } else if (kind < 65) {
+                    word.erase(position, 1);
+                } else if (kind < 85) {
+                    word.insert(position, 1, random_() % 2 ? word[position] : neighbour(word[position]));
+                } else if (position + 1 < word.size()) {
+                    std::swap(word[position], word[position + 1]);
+                } else {
+                    std::swap(word[position - 1], word[position]);
+                }
+            }
+            return word;
+        }
+
+    private:
+        wchar_t neighbour(wchar_t key) {
+            auto neighbours = neighbours_.find(key);
+            if (neighbours == neighbours_.end() || neighbours->second.empty()) {
+                return key;
+            }
+            return neighbours->second[random_() % neighbours->second.size()];
+        }
+
+        std::mt19937_64 random_;
+        std::unordered_map<wchar_t, std::wstring> neighbours_;
+    };
+
+    // Misspelled dictionary words, popular words being queried more often.
+    inline std::vector<SearchQuery> GenerateQueries(const DictionaryEntries& words, size_t count, uint32_t tolerance,
+            const Script& script, uint64_t seed) {
+        std::mt19937_64 random(seed);
+        TypoModel typo_model(script, seed + 1);
+        // ranks by a Zipf law with exponent 1, through the inverse of its continuous approximation
+        double log_size = std::log(static_cast<double>(words.size()) + 1);
+        std::uniform_real_distribution<double> uniform(0, 1);
+        std::vector<SearchQuery> queries;
+        queries.reserve(count);
+        for (size_t index = 0; index < count; ++index) {
+            auto rank = static_cast<size_t>(std::exp(uniform(random) * log_size)) - 1;
+            const std::wstring& word = words[std::min(rank, words.size() - 1)].first;
+            queries.push_back({typo_model.Misspell(word, typo_model.TyposFor(tolerance)), tolerance, 0});
+        }
+        return queries;
+    }
+}
@@ -0,0 +1,68 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+
+
+// Bounds the number of search requests served at once. Requests past the limit are turned away immediately
+// instead of waiting behind the others, so latency of the admitted ones stays flat under overload.
+class AdmissionControl {
+public:
+    // Holds one of the slots while alive, if it managed to take one.
+    class Ticket {
+    public:
+        explicit Ticket(std::shared_ptr<AdmissionControl> control) : control_(std::move(control)) {
+            if (!control_->try_enter()) {
+                control_.reset();
+            }
+        }
+
+        Ticket(Ticket&& other) noexcept = default;
+        Ticket& operator=(Ticket&& other) = delete;
+
+        ~Ticket() {
+            if (control_ != nullptr) {
+                --control_->in_flight_;
+            }
+        }
+
+        explicit operator bool() const {
+            return control_ != nullptr;
+        }
+
+    private:
+        std::shared_ptr<AdmissionControl> control_;
+    };
+
+    explicit AdmissionControl(size_t limit) : limit_(limit) {
+    }
+
+    [[nodiscard]] size_t Limit() const {
+        return limit_;
+    }
+
+    [[nodiscard]] size_t InFlight() const {
+        return in_flight_.load();
+    }
+
+    [[nodiscard]] uint64_t Rejected() const {
+        return rejected_.load();
+    }
+
+private:
+    bool try_enter() {
+        size_t current = in_flight_.load();
+        do {
+            if (current >= limit_) {
+                ++rejected_;
+                return false;
+            }
+        } while (!in_flight_.compare_exchange_weak(current, current + 1));
+        return true;
+    }
+
+    const size_t limit_;
+    std::atomic<size_t> in_flight_{0};
+    std::atomic<uint64_t> rejected_{0};
+};
@@ -6,8 +6,20 @@
 #include <Poco/Util/OptionCallback.h>
 #include <Poco/Util/HelpFormatter.h>
 #include <Poco/Logger.h>
+#include <Poco/Timespan.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cctype>
+#include <csignal>
+#include <string_view>
+#include <thread>
+#include <pthread.h>
 
 #include "web_server.h"
+#include "binary_server.h"
+#include "symspell_index.h"
+#include "sharded_dictionary.h"
 
 using namespace Poco::Util;
 
@@ -30,14 +42,36 @@ public:
 
 protected:
     void setDictionaryPath(const std::string&, const std::string& value);
+    void setIndexPath(const std::string&, const std::string& value);
+    void setBuildIndex(const std::string&, const std::string& value);
     void setMetricConfigPath(const std::string&, const std::string& value);
+    void setEngine(const std::string&, const std::string& value);
+    void setSymSpellMaxDistance(const std::string&, const std::string& value);
+    void setShards(const std::string&, const std::string& value);
     void setAddress(const std::string&, const std::string& value);
     void setPort(const std::string&, const std::string& value);
+    void setBinaryPort(const std::string&, const std::string& value);
+    void setBatchThreads(const std::string&, const std::string& value);
+    void setHttpThreads(const std::string&, const std::string& value);
+    void setHttpQueue(const std::string&, const std::string& value);
+    void setKeepAliveTimeout(const std::string&, const std::string& value);
+    void setMaxInFlight(const std::string&, const std::string& value);
+    void setDeadline(const std::string&, const std::string& value);
+    void setMaxNodesVisited(const std::string&, const std::string& value);
+    void setCacheSize(const std::string&, const std::string& value);
     void handleHelp(const std::string& name, const std::string& value);
 
-    std::shared_ptr<AbstractWStringMetric> getMetric() const;
+    // Options given per dictionary are "name=value", the name is empty if there is none.
+    static std::pair<std::string, std::string> splitDictionaryOption(const std::string& value);
+    void setDictionaryOption(const std::string& name, const std::string& option, const std::string& value);
+    std::shared_ptr<AbstractWStringMetric> getMetric(const std::string& name) const;
+    std::shared_ptr<Dictionary> getDictionary(const std::string& name,
+            const std::shared_ptr<AbstractWStringMetric>& metric, const std::shared_ptr<ThreadPool>& thread_pool) const;
+    static void reloadDictionaries(DictionaryRegistry& dictionaries);
 
     bool is_help_requested_ = false;
+    // in the order of the command line, the first one is the default unless there is one named "default"
+    std::vector<std::string> dictionary_names_;
 };
 
 int CorrectorServerApp::main(const std::vector<std::string>& flags) {
@@ -45,15 +79,84 @@ int CorrectorServerApp::main(const std::vector<std::string>& flags) {
         displayHelp();
         return ServerApplication::EXIT_OK;
     }
-    auto metric = getMetric();
-    auto dictionary = std::make_shared<BKTree>(this->config().getString("dictionary_path"), metric);
+    if (this->config().hasProperty("build_index")) {
+        if (dictionary_names_.size() != 1 ||
+                !this->config().hasProperty("dictionaries." + dictionary_names_.front() + ".dictionary_path")) {
+            throw std::runtime_error("A single dictionary_path is required to build index");
+        }
+        const std::string& name = dictionary_names_.front();
+        std::string dictionary_path = this->config().getString("dictionaries." + name + ".dictionary_path");
+        std::string index_path = this->config().getString("build_index");
+        auto shards_count = this->config().getUInt("shards", 1);
+        if (shards_count == 1) {
+            BKTree dictionary(dictionary_path, getMetric(name));
+            std::cerr << Poco::format("Writing bk_tree index to %s... ", index_path);
+            dictionary.SaveIndex(index_path);
+            std::cerr << "Done!" << std::endl;
+            return Application::EXIT_OK;
+        }
+        ShardedDictionary::SaveIndex(ShardedDictionary::Build(dictionary_path, getMetric(name), shards_count),
+                index_path);
+        return Application::EXIT_OK;
+    }
+
+    // SIGHUP triggers reload; it's blocked before any thread starts, so only the reload thread receives it
+    sigset_t reload_signals;
+    sigemptyset(&reload_signals);
+    sigaddset(&reload_signals, SIGHUP);
+    pthread_sigmask(SIG_BLOCK, &reload_signals, nullptr);
+
+    if (dictionary_names_.empty()) {
+        throw std::runtime_error("Either dictionary_path or index_path must be specified");
+    }
+    auto cores = std::max(1u, std::thread::hardware_concurrency());
+    auto batch_threads = this->config().getUInt("batch_threads", cores);
+    auto thread_pool = std::make_shared<ThreadPool>(batch_threads);
+
+    // metric configs are parsed anew on every reload, so their changes are picked up too
+    DictionaryRegistry::NamedLoaders loaders;
+    for (const std::string& name: dictionary_names_) {
+        loaders.emplace_back(name, [this, name, thread_pool]() {
+            return getDictionary(name, getMetric(name), thread_pool);
+        });
+    }
+    auto dictionaries = std::make_shared<DictionaryRegistry>(std::move(loaders));
 
-    auto handler_factory = new CorrectorHandlerFactory(dictionary);
+    std::atomic<bool> is_stopping(false);
+    std::thread reload_thread([&reload_signals, &is_stopping, dictionaries]() {
+        int signal = 0;
+        while (sigwait(&reload_signals, &signal) == 0 && !is_stopping) {
+            reloadDictionaries(*dictionaries);
+        }
+    });
+
+    // connection threads mostly wait on the network and the pool, and there must be spare ones to turn requests
+    // past max_in_flight away quickly, so there are more of them than requests admitted
+    auto http_threads = this->config().getUInt("http_threads", std::max(16u, 4 * cores));
+    auto max_in_flight = this->config().getUInt("max_in_flight", std::max(8u, 2 * cores));
+    auto admission_control = std::make_shared<AdmissionControl>(max_in_flight);
+
+    std::shared_ptr<SearchCache> cache;
+    if (auto cache_size = this->config().getUInt("cache_size", 1 << 16); cache_size != 0) {
+        cache = std::make_shared<SearchCache>(cache_size);
+    }
+
+    SearchExecutor::Limits limits{this->config().getUInt("deadline_ms", 1000),
+            this->config().getUInt("max_nodes_visited", 0)};
+    auto search_executor = std::make_shared<SearchExecutor>(dictionaries, thread_pool, cache, limits);
+    // a short queue turns connections away with 503 instead of letting them wait for threads held by other clients
+    auto http_queue = static_cast<int>(this->config().getUInt("http_queue", 64));
+    Poco::AutoPtr<ConnectionLimit> connection_limit(
+            new ConnectionLimit(http_queue, CorrectorHandlerFactory::QueueFullResponse()));
+    auto handler_factory = new CorrectorHandlerFactory(search_executor, admission_control, connection_limit);
     auto params = new HTTPServerParams;
 
-    params->setMaxQueued(1000);
-    params->setMaxThreads(8);
-    params->setTimeout(1000);
+    params->setMaxQueued(http_queue);
+    params->setMaxThreads(static_cast<int>(http_threads));
+    params->setTimeout(Poco::Timespan(10, 0));
+    auto keep_alive_timeout = this->config().getUInt("keep_alive_timeout", 15);
+    params->setKeepAlive(keep_alive_timeout != 0);
+    params->setKeepAliveTimeout(Poco::Timespan(static_cast<long>(keep_alive_timeout), 0));
 
     std::string address = this->config().getString("address", "0.0.0.0");
     int port = this->config().getInt("port", 9000);
@@ -62,6 +165,23 @@ int CorrectorServerApp::main(const std::vector<std::string>& flags) {
             std::make_shared<ServerSocket>(SocketAddress(address, port));
 
     HTTPServer server(handler_factory, *socket_server, params);
+    connection_limit->Attach(server);
+    server.setConnectionFilter(connection_limit);
+
+    std::unique_ptr<TCPServer> binary_server;
+    if (this->config().hasProperty("binary_port")) {
+        auto binary_params = new TCPServerParams;
+        binary_params->setMaxQueued(http_queue);
+        binary_params->setMaxThreads(static_cast<int>(http_threads));
+        binary_server = std::make_unique<TCPServer>(
+                new BinaryProtocolConnectionFactory(search_executor, admission_control),
+                ServerSocket(SocketAddress(address, this->config().getInt("binary_port"))), binary_params);
+        // the binary protocol has no frame to answer a connection with, so ones past the queue are just closed
+        Poco::AutoPtr<ConnectionLimit> binary_connection_limit(new ConnectionLimit(http_queue, ""));
+        binary_connection_limit->Attach(*binary_server);
+        binary_server->setConnectionFilter(binary_connection_limit);
+        binary_server->start();
+    }
 
     server.start();
     std::wcout << std::endl << "Server started" << std::endl;
@@ -70,6 +190,12 @@ int CorrectorServerApp::main(const std::vector<std::string>& flags) {
 
     std::wcout << std::endl << "Shutting down..." << std::endl;
     server.stop();
+    if (binary_server != nullptr) {
+        binary_server->stop();
+    }
+    is_stopping = true;
+    pthread_kill(reload_thread.native_handle(), SIGHUP);
+    reload_thread.join();
 
     return Application::EXIT_OK;
 }
@@ -84,21 +210,69 @@ void CorrectorServerApp::defineOptions(OptionSet& options) {
     );
 
     options.addOption(
-            Option("dictionary_path", "d", "Path to dictionary file")
+            Option("dictionary_path", "d", "Path to dictionary file, [name=]path, repeat to serve several dictionaries "
+                                           "chosen by the \"dictionary\" field of requests")
                     .repeatable(true)
-                    .required(true)
+                    .required(false)
                     .argument("dictionary_path", true)
                     .callback(OptionCallback<CorrectorServerApp>(this, &CorrectorServerApp::setDictionaryPath))
     );
 
     options.addOption(
-            Option("metric_config", "m", "Path to metric description file")
+            Option("index_path", "i", "Path to binary index file to serve instead of dictionary file, [name=]path")
+                    .repeatable(true)
+                    .required(false)
+                    .argument("index_path", true)
+                    .callback(OptionCallback<CorrectorServerApp>(this, &CorrectorServerApp::setIndexPath))
+    );
+
+    options.addOption(
+            Option("build_index", "b", "Build binary index of dictionary file, write it to given path and exit")
                     .repeatable(false)
                     .required(false)
+                    .argument("index_path", true)
+                    .callback(OptionCallback<CorrectorServerApp>(this, &CorrectorServerApp::setBuildIndex))
+    );
+
+    options.addOption(
+            Option("metric_config", "m", "Path to metric description file, [name=]path, the one without a name is "
+                                         "used by dictionaries without their own")
+                    .repeatable(true)
+                    .required(false)
                     .argument("metric_config", true)
                     .callback(OptionCallback<CorrectorServerApp>(this, &CorrectorServerApp::setMetricConfigPath))
     );
 
+    options.addOption(
+            Option("engine", "e", "Search engine: bktree (default) or symspell, which answers queries with "
+                                  "tolerances up to symspell_max_distance from a symmetric delete index")
+                    .repeatable(false)
+                    .required(false)
+                    .argument("engine", true)
+                    .callback(OptionCallback<CorrectorServerApp>(this, &CorrectorServerApp::setEngine))
+    );
+
+    options.addOption(
+            Option("symspell_max_distance", "s", "Largest tolerance served by the symspell engine, 2 by default")
+                    .repeatable(false)
+                    .required(false)
+                    .argument("symspell_max_distance", true)
+                    .validator(new Poco::Util::IntValidator(0, 4))
+                    .callback(OptionCallback<CorrectorServerApp>(this, &CorrectorServerApp::setSymSpellMaxDistance))
+    );
+
+    options.addOption(
+            Option("shards", "r", "Number of trees every dictionary is split into by word hash, 1 by default. Shards "
+                                  "are built in parallel and every query searches all of them at once. Index files "
+                                  "are written and read as index_path.0, index_path.1 and so on, and index_path "
+                                  "records their number")
+                    .repeatable(false)
+                    .required(false)
+                    .argument("shards", true)
+                    .validator(new Poco::Util::IntValidator(1, 1024))
+                    .callback(OptionCallback<CorrectorServerApp>(this, &CorrectorServerApp::setShards))
+    );
+
     options.addOption(
             Option("address", "a", "Host to serve app")
                     .repeatable(false)
@@ -115,14 +289,152 @@ void CorrectorServerApp::defineOptions(OptionSet& options) {
                     .validator(new Poco::Util::IntValidator(1, 65536))
                     .callback(OptionCallback<CorrectorServerApp>(this, &CorrectorServerApp::setPort))
     );
+
+    options.addOption(
+            Option("binary_port", "n", "Port to serve the binary protocol on, disabled by default")
+                    .repeatable(false)
+                    .required(false)
+                    .argument("binary_port", true)
+                    .validator(new Poco::Util::IntValidator(1, 65536))
+                    .callback(OptionCallback<CorrectorServerApp>(this, &CorrectorServerApp::setBinaryPort))
+    );
+
+    options.addOption(
+            Option("batch_threads", "t", "Number of threads processing batches of requests, all cores by default")
+                    .repeatable(false)
+                    .required(false)
+                    .argument("batch_threads", true)
+                    .validator(new Poco::Util::IntValidator(1, 1024))
+                    .callback(OptionCallback<CorrectorServerApp>(this, &CorrectorServerApp::setBatchThreads))
+    );
+
+    options.addOption(
+            Option("http_threads", "w", "Number of threads serving connections, 4 per core and at least 16 by default")
+                    .repeatable(false)
+                    .required(false)
+                    .argument("http_threads", true)
+                    .validator(new Poco::Util::IntValidator(1, 65536))
+                    .callback(OptionCallback<CorrectorServerApp>(this, &CorrectorServerApp::setHttpThreads))
+    );
+
+    options.addOption(
+            Option("http_queue", "q", "Number of accepted connections waiting for a thread, 64 by default. "
+                                      "Further ones get 503 at once")
+                    .repeatable(false)
+                    .required(false)
+                    .argument("http_queue", true)
+                    .validator(new Poco::Util::IntValidator(1, std::numeric_limits<int>::max()))
+                    .callback(OptionCallback<CorrectorServerApp>(this, &CorrectorServerApp::setHttpQueue))
+    );
+
+    options.addOption(
+            Option("keep_alive_timeout", "k", "Seconds an idle connection is kept open, 15 by default, 0 disables "
+                                              "keep-alive")
+                    .repeatable(false)
+                    .required(false)
+                    .argument("keep_alive_timeout", true)
+                    .validator(new Poco::Util::IntValidator(0, 3600))
+                    .callback(OptionCallback<CorrectorServerApp>(this, &CorrectorServerApp::setKeepAliveTimeout))
+    );
+
+    options.addOption(
+            Option("max_in_flight", "f", "Number of search requests served at once, the ones past it get 503, "
+                                         "2 per core and at least 8 by default")
+                    .repeatable(false)
+                    .required(false)
+                    .argument("max_in_flight", true)
+                    .validator(new Poco::Util::IntValidator(1, std::numeric_limits<int>::max()))
+                    .callback(OptionCallback<CorrectorServerApp>(this, &CorrectorServerApp::setMaxInFlight))
+    );
+
+    options.addOption(
+            Option("deadline_ms", "l", "Milliseconds a single query may search for before its best results so far "
+                                       "are returned as truncated, 1000 by default, 0 disables the bound")
+                    .repeatable(false)
+                    .required(false)
+                    .argument("deadline_ms", true)
+                    .validator(new Poco::Util::IntValidator(0, std::numeric_limits<int>::max()))
+                    .callback(OptionCallback<CorrectorServerApp>(this, &CorrectorServerApp::setDeadline))
+    );
+
+    options.addOption(
+            Option("max_nodes_visited", "v", "Number of tree nodes a single query may visit before its best results so "
+                                             "far are returned as truncated, unbounded by default")
+                    .repeatable(false)
+                    .required(false)
+                    .argument("max_nodes_visited", true)
+                    .validator(new Poco::Util::IntValidator(0, std::numeric_limits<int>::max()))
+                    .callback(OptionCallback<CorrectorServerApp>(this, &CorrectorServerApp::setMaxNodesVisited))
+    );
+
+    options.addOption(
+            Option("cache_size", "c", "Number of cached search results, 65536 by default, 0 disables the cache")
+                    .repeatable(false)
+                    .required(false)
+                    .argument("cache_size", true)
+                    .validator(new Poco::Util::IntValidator(0, std::numeric_limits<int>::max()))
+                    .callback(OptionCallback<CorrectorServerApp>(this, &CorrectorServerApp::setCacheSize))
+    );
+}
+
+// The part before the first '=' is a name only if it's a plain identifier, so paths like /data/a=b.txt stay whole.
+std::pair<std::string, std::string> CorrectorServerApp::splitDictionaryOption(const std::string& value) {
+    size_t separator = value.find('=');
+    if (separator == 0 || separator == std::string::npos) {
+        return {"", value};
+    }
+    std::string_view name(value.data(), separator);
+    bool is_identifier = name.find('/') == std::string_view::npos && std::all_of(name.begin(), name.end(),
+            [](char ch) {
+                return std::isalnum(static_cast<unsigned char>(ch)) || ch == '_' || ch == '-';
+            });
+    if (!is_identifier) {
+        return {"", value};
+    }
+    return {std::string(name), value.substr(separator + 1)};
+}
+
+void CorrectorServerApp::setDictionaryOption(const std::string& name, const std::string& option,
+        const std::string& value) {
+    if (std::find(dictionary_names_.begin(), dictionary_names_.end(), name) == dictionary_names_.end()) {
+        dictionary_names_.push_back(name);
+    }
+    this->config().setString("dictionaries." + name + "." + option, value);
 }
 
 void CorrectorServerApp::setMetricConfigPath(const std::string&, const std::string& value) {
-    this->config().setString("metric_config", value);
+    auto [name, path] = splitDictionaryOption(value);
+    if (name.empty()) {
+        this->config().setString("metric_config", path);
+    } else {
+        setDictionaryOption(name, "metric_config", path);
+    }
+}
+
+void CorrectorServerApp::setEngine(const std::string&, const std::string& value) {
+    this->config().setString("engine", value);
+}
+
+void CorrectorServerApp::setSymSpellMaxDistance(const std::string&, const std::string& value) {
+    this->config().setUInt("symspell_max_distance", std::stoul(value));
+}
+
+void CorrectorServerApp::setShards(const std::string&, const std::string& value) {
+    this->config().setUInt("shards", std::stoul(value));
 }
 
 void CorrectorServerApp::setDictionaryPath(const std::string&, const std::string& value) {
-    this->config().setString("dictionary_path", value);
+    auto [name, path] = splitDictionaryOption(value);
+    setDictionaryOption(name.empty() ? DictionaryRegistry::kDefaultName : name, "dictionary_path", path);
+}
+
+void CorrectorServerApp::setIndexPath(const std::string&, const std::string& value) {
+    auto [name, path] = splitDictionaryOption(value);
+    setDictionaryOption(name.empty() ? DictionaryRegistry::kDefaultName : name, "index_path", path);
+}
+
+void CorrectorServerApp::setBuildIndex(const std::string&, const std::string& value) {
+    this->config().setString("build_index", value);
 }
 
 void CorrectorServerApp::initialize(Application& application) {
@@ -130,12 +442,16 @@ void CorrectorServerApp::initialize(Application& application) {
     ServerApplication::initialize(application);
 }
 
-std::shared_ptr<AbstractWStringMetric> CorrectorServerApp::getMetric() const {
-    if (!this->config().hasProperty("metric_config")) {
-        std::cerr << "Default Levenstein metric will be used" << std::endl;
+std::shared_ptr<AbstractWStringMetric> CorrectorServerApp::getMetric(const std::string& name) const {
+    std::string key = "dictionaries." + name + ".metric_config";
+    if (!this->config().hasProperty(key)) {
+        key = "metric_config";
+    }
+    if (!this->config().hasProperty(key)) {
+        std::cerr << Poco::format("Default Levenstein metric will be used for dictionary %s", name) << std::endl;
         return std::make_shared<LevensteinMetric>();
     } else {
-        std::string metric_config_name = this->config().getString("metric_config");
+        std::string metric_config_name = this->config().getString(key);
         try {
             std::cerr << Poco::format("Parsing metric config file: %s...", metric_config_name);
             auto result = std::make_shared<WeightedLevensteinMetric>(metric_config_name);
@@ -151,6 +467,69 @@ std::shared_ptr<AbstractWStringMetric> CorrectorServerApp::getMetric() const {
     }
 }
 
+std::shared_ptr<Dictionary> CorrectorServerApp::getDictionary(const std::string& name,
+        const std::shared_ptr<AbstractWStringMetric>& metric, const std::shared_ptr<ThreadPool>& thread_pool) const {
+    std::string engine = this->config().getString("engine", "bktree");
+    if (engine != "bktree" && engine != "symspell") {
+        throw std::runtime_error(Poco::format("Unknown engine \"%s\", expected bktree or symspell", engine));
+    }
+    std::string prefix = "dictionaries." + name + ".";
+    std::vector<std::unique_ptr<BKTree>> trees;
+    auto shards_count = this->config().getUInt("shards", 1);
+    if (this->config().hasProperty(prefix + "index_path")) {
+        std::string index_path = this->config().getString(prefix + "index_path");
+        if (shards_count == 1) {
+            trees.push_back(std::make_unique<BKTree>(metric, index_path));
+        } else {
+            trees = ShardedDictionary::Load(index_path, metric, shards_count);
+        }
+    } else if (this->config().hasProperty(prefix + "dictionary_path")) {
+        std::string dictionary_path = this->config().getString(prefix + "dictionary_path");
+        if (shards_count == 1) {
+            trees.push_back(std::make_unique<BKTree>(dictionary_path, metric));
+        } else {
+            trees = ShardedDictionary::Build(dictionary_path, metric, shards_count);
+        }
+    } else {
+        throw std::runtime_error(Poco::format("Either dictionary_path or index_path must be specified for "
+                                              "dictionary %s", name));
+    }
+    ShardedDictionary::Shards shards;
+    for (auto& tree: trees) {
+        if (engine == "symspell") {
+            shards.push_back(std::make_unique<SymSpellIndex>(std::move(tree),
+                    this->config().getUInt("symspell_max_distance", 2)));
+        } else {
+            shards.push_back(std::move(tree));
+        }
+    }
+    if (shards.size() == 1) {
+        return std::move(shards.front());
+    }
+    return std::make_shared<ShardedDictionary>(std::move(shards), thread_pool);
+}
+
+void CorrectorServerApp::reloadDictionaries(DictionaryRegistry& dictionaries) {
+    std::cerr << "Reloading dictionaries..." << std::endl;
+    auto outcomes = dictionaries.Reload();
+    for (uint32_t index = 0; index < dictionaries.Size(); ++index) {
+        const std::string& name = dictionaries.Name(index);
+        switch (outcomes[index].status) {
+            case DictionaryRegistry::ReloadStatus::kReloaded:
+                std::cerr << Poco::format("Dictionary %s reloaded, generation %Lu", name,
+                        dictionaries.Holder(index)->Generation()) << std::endl;
+                break;
+            case DictionaryRegistry::ReloadStatus::kInProgress:
+                std::cerr << Poco::format("Dictionary %s reload is already in progress", name) << std::endl;
+                break;
+            case DictionaryRegistry::ReloadStatus::kFailed:
+                std::cerr << Poco::format("Dictionary %s reload failed, previous one is kept serving", name)
+                          << std::endl << outcomes[index].error << std::endl;
+                break;
+        }
+    }
+}
+
 void CorrectorServerApp::handleHelp(const std::string& name, const std::string& value) {
     if (name == "help") {
         is_help_requested_ = true;
@@ -165,3 +544,39 @@ void CorrectorServerApp::setAddress(const std::string&, const std::string& value
 void CorrectorServerApp::setPort(const std::string&, const std::string& value) {
     this->config().setInt("port", std::stoi(value));
 }
+
+void CorrectorServerApp::setBinaryPort(const std::string&, const std::string& value) {
+    this->config().setInt("binary_port", std::stoi(value));
+}
+
+void CorrectorServerApp::setBatchThreads(const std::string&, const std::string& value) {
+    this->config().setUInt("batch_threads", std::stoul(value));
+}
+
+void CorrectorServerApp::setCacheSize(const std::string&, const std::string& value) {
+    this->config().setUInt("cache_size", std::stoul(value));
+}
+
+void CorrectorServerApp::setHttpThreads(const std::string&, const std::string& value) {
+    this->config().setUInt("http_threads", std::stoul(value));
+}
+
+void CorrectorServerApp::setHttpQueue(const std::string&, const std::string& value) {
+    this->config().setUInt("http_queue", std::stoul(value));
+}
+
+void CorrectorServerApp::setKeepAliveTimeout(const std::string&, const std::string& value) {
+    this->config().setUInt("keep_alive_timeout", std::stoul(value));
+}
+
+void CorrectorServerApp::setMaxInFlight(const std::string&, const std::string& value) {
+    this->config().setUInt("max_in_flight", std::stoul(value));
+}
+
+void CorrectorServerApp::setDeadline(const std::string&, const std::string& value) {
+    this->config().setUInt("deadline_ms", std::stoul(value));
+}
+
+void CorrectorServerApp::setMaxNodesVisited(const std::string&, const std::string& value) {
+    this->config().setUInt("max_nodes_visited", std::stoul(value));
+}
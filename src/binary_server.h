@@ -0,0 +1,197 @@
+#pragma once
+
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <Poco/Net/StreamSocket.h>
+#include <Poco/Net/TCPServer.h>
+#include <Poco/Net/TCPServerConnection.h>
+#include <Poco/Net/TCPServerConnectionFactory.h>
+#include <Poco/Net/TCPServerParams.h>
+
+#include "search_executor.h"
+#include "admission_control.h"
+#include "utf8.h"
+#include "telemetry.h"
+
+using namespace Poco::Net;
+
+
+// Length-prefixed binary protocol for internal clients, all integers are little-endian uint32.
+// Request:  length, id, tolerance, limit, word size, word in UTF-8.
+// Response: length, id, status, results count, then tolerance, priority, word size and UTF-8 word of every result.
+// Length counts the bytes following it. Requests may be pipelined on one connection: the ones already received
+// are searched together and answered in the order of arrival, id lets clients match them anyway.
+namespace binary_protocol {
+    constexpr size_t kHeaderSize = 4;
+    constexpr size_t kRequestFixedSize = 16;
+    constexpr size_t kMaxFrameSize = 1 << 20;
+    constexpr size_t kMaxPipelined = 256;
+
+    enum Status : uint32_t {
+        kOk = 0,
+        kBadRequest = 1,
+        kOverloaded = 2,
+        // results are the best found before the server bounds of the query ran out
+        kTruncated = 3
+    };
+
+    inline uint32_t GetUInt32(const char* data) {
+        auto bytes = reinterpret_cast<const unsigned char*>(data);
+        return static_cast<uint32_t>(bytes[0]) | static_cast<uint32_t>(bytes[1]) << 8 |
+                static_cast<uint32_t>(bytes[2]) << 16 | static_cast<uint32_t>(bytes[3]) << 24;
+    }
+
+    inline void PutUInt32(std::string& output, uint32_t value) {
+        const char bytes[] = {static_cast<char>(value), static_cast<char>(value >> 8),
+                static_cast<char>(value >> 16), static_cast<char>(value >> 24)};
+        output.append(bytes, sizeof(bytes));
+    }
+}
+
+
+class BinaryProtocolConnection : public TCPServerConnection {
+public:
+    BinaryProtocolConnection(const StreamSocket& socket, std::shared_ptr<SearchExecutor> search_executor,
+            std::shared_ptr<AdmissionControl> admission_control)
+        : TCPServerConnection(socket), search_executor_(std::move(search_executor)),
+          admission_control_(std::move(admission_control)) {
+    }
+
+    // Serves the connection until the client closes it or breaks the framing.
+    void run() override {
+        std::vector<char> buffer;
+        size_t parsed = 0;
+        char chunk[1 << 16];
+        while (true) {
+            int received = socket().receiveBytes(chunk, sizeof(chunk));
+            if (received <= 0) {
+                return;
+            }
+            buffer.erase(buffer.begin(), buffer.begin() + static_cast<std::ptrdiff_t>(parsed));
+            parsed = 0;
+            buffer.insert(buffer.end(), chunk, chunk + received);
+
+            while (true) {
+                requests_.clear();
+                queries_.clear();
+                auto parse_start = telemetry::Clock::now();
+                while (requests_.size() < binary_protocol::kMaxPipelined &&
+                        buffer.size() - parsed >= binary_protocol::kHeaderSize) {
+                    size_t frame_size = binary_protocol::GetUInt32(buffer.data() + parsed);
+                    if (frame_size > binary_protocol::kMaxFrameSize) {
+                        return;
+                    }
+                    if (buffer.size() - parsed < binary_protocol::kHeaderSize + frame_size) {
+                        break;
+                    }
+                    parse_request(buffer.data() + parsed + binary_protocol::kHeaderSize, frame_size);
+                    parsed += binary_protocol::kHeaderSize + frame_size;
+                }
+                if (requests_.empty()) {
+                    break;
+                }
+                telemetry::Add(telemetry::kParseMicroseconds, telemetry::MicrosecondsSince(parse_start));
+                respond(parse_start);
+            }
+        }
+    }
+
+private:
+    struct Request {
+        uint32_t id;
+        binary_protocol::Status status;
+    };
+
+    void parse_request(const char* frame, size_t frame_size) {
+        Request request{frame_size >= 4 ? binary_protocol::GetUInt32(frame) : 0, binary_protocol::kBadRequest};
+        if (frame_size >= binary_protocol::kRequestFixedSize) {
+            uint32_t word_size = binary_protocol::GetUInt32(frame + 12);
+            std::wstring word;
+            if (word_size == frame_size - binary_protocol::kRequestFixedSize &&
+                    utf8::Decode(std::string_view(frame + binary_protocol::kRequestFixedSize, word_size), word)) {
+                queries_.push_back({std::move(word), binary_protocol::GetUInt32(frame + 4),
+                        binary_protocol::GetUInt32(frame + 8)});
+                request.status = binary_protocol::kOk;
+            }
+        }
+        requests_.push_back(request);
+    }
+
+    // A batch past the admission limit is answered with kOverloaded for every request in it.
+    void respond(telemetry::Clock::time_point batch_start) {
+        AdmissionControl::Ticket ticket(admission_control_);
+        SearchExecutor::Results results;
+        if (ticket) {
+            results = search_executor_->Search(search_executor_->TakeSnapshot(), queries_);
+        }
+        auto serialize_start = telemetry::Clock::now();
+        std::string output;
+        size_t query_index = 0;
+        for (const Request& request: requests_) {
+            size_t frame_begin = output.size();
+            binary_protocol::PutUInt32(output, 0);
+            binary_protocol::PutUInt32(output, request.id);
+            auto status = request.status;
+            if (status == binary_protocol::kOk && !ticket) {
+                status = binary_protocol::kOverloaded;
+            } else if (status == binary_protocol::kOk && results.truncated[query_index] != 0) {
+                status = binary_protocol::kTruncated;
+            }
+            binary_protocol::PutUInt32(output, status);
+            if (status != binary_protocol::kOk && status != binary_protocol::kTruncated) {
+                binary_protocol::PutUInt32(output, 0);
+            } else {
+                const auto& found = *results.results[query_index++];
+                binary_protocol::PutUInt32(output, static_cast<uint32_t>(found.size()));
+                for (const auto& elem: found) {
+                    if (!utf8::Encode(elem.result, encoded_word_)) {
+                        throw std::range_error("Invalid code point in string");
+                    }
+                    binary_protocol::PutUInt32(output, elem.tolerance);
+                    binary_protocol::PutUInt32(output, elem.priority);
+                    binary_protocol::PutUInt32(output, static_cast<uint32_t>(encoded_word_.size()));
+                    output += encoded_word_;
+                }
+            }
+            std::string frame_size;
+            binary_protocol::PutUInt32(frame_size,
+                    static_cast<uint32_t>(output.size() - frame_begin - binary_protocol::kHeaderSize));
+            output.replace(frame_begin, binary_protocol::kHeaderSize, frame_size);
+        }
+        telemetry::Add(telemetry::kSerializeMicroseconds, telemetry::MicrosecondsSince(serialize_start));
+        for (size_t sent = 0; sent < output.size();) {
+            int count = socket().sendBytes(output.data() + sent, static_cast<int>(output.size() - sent));
+            if (count <= 0) {
+                throw std::runtime_error("Connection closed while sending response");
+            }
+            sent += static_cast<size_t>(count);
+        }
+        telemetry::Observe(telemetry::kRequestDuration, telemetry::MicrosecondsSince(batch_start));
+    }
+
+    std::shared_ptr<SearchExecutor> search_executor_;
+    std::shared_ptr<AdmissionControl> admission_control_;
+    std::vector<Request> requests_;
+    std::vector<SearchQuery> queries_;
+    std::string encoded_word_;
+};
+
+
+class BinaryProtocolConnectionFactory : public TCPServerConnectionFactory {
+public:
+    BinaryProtocolConnectionFactory(std::shared_ptr<SearchExecutor> search_executor,
+            std::shared_ptr<AdmissionControl> admission_control)
+        : TCPServerConnectionFactory(), search_executor_(std::move(search_executor)),
+          admission_control_(std::move(admission_control)) {
+    }
+
+    TCPServerConnection* createConnection(const StreamSocket& socket) override {
+        return new BinaryProtocolConnection(socket, search_executor_, admission_control_);
+    }
+
+private:
+    std::shared_ptr<SearchExecutor> search_executor_;
+    std::shared_ptr<AdmissionControl> admission_control_;
+};
@@ -0,0 +1,281 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <limits>
+#include <string_view>
+
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+#include <immintrin.h>
+#define BIT_PARALLEL_X86 1
+#endif
+
+
+// Match masks of a pattern of at most 64 characters: bit i of Get(ch) is set iff pattern[i] == ch.
+// Characters are kept in an open addressing table indexed by the low byte of the code point, which keeps
+// the letters of one script apart, so lookups are a single branchless probe unless the pattern collides.
+class PatternMasks {
+public:
+    static constexpr size_t kMaxLength = 64;
+
+    bool Assign(std::wstring_view pattern) {
+        for (size_t index = 0; index < used_count_; ++index) {
+            masks_[used_[index]] = 0;
+        }
+        used_count_ = 0;
+        is_collision_free_ = true;
+        if (pattern.size() > kMaxLength) {
+            length_ = 0;
+            return false;
+        }
+        length_ = pattern.size();
+        for (size_t index = 0; index < pattern.size(); ++index) {
+            size_t slot = get_slot(pattern[index]);
+            while (masks_[slot] != 0 && keys_[slot] != pattern[index]) {
+                is_collision_free_ = false;
+                slot = (slot + 1) & (kSlots - 1);
+            }
+            if (masks_[slot] == 0) {
+                keys_[slot] = pattern[index];
+                used_[used_count_++] = static_cast<uint8_t>(slot);
+            }
+            masks_[slot] |= uint64_t(1) << index;
+        }
+        return true;
+    }
+
+    [[nodiscard]] uint64_t Get(wchar_t ch) const {
+        size_t slot = get_slot(ch);
+        if (is_collision_free_) {
+            return masks_[slot] & (uint64_t(0) - static_cast<uint64_t>(keys_[slot] == ch));
+        }
+        while (masks_[slot] != 0) {
+            if (keys_[slot] == ch) {
+                return masks_[slot];
+            }
+            slot = (slot + 1) & (kSlots - 1);
+        }
+        return 0;
+    }
+
+    [[nodiscard]] size_t Length() const {
+        return length_;
+    }
+
+    [[nodiscard]] uint64_t LastBit() const {
+        return length_ == 0 ? 0 : uint64_t(1) << (length_ - 1);
+    }
+
+private:
+    static constexpr size_t kSlots = 256;
+
+    static size_t get_slot(wchar_t ch) {
+        return static_cast<uint32_t>(ch) & (kSlots - 1);
+    }
+
+    wchar_t keys_[kSlots] = {};
+    uint64_t masks_[kSlots] = {};
+    uint8_t used_[kMaxLength] = {};
+    size_t used_count_ = 0;
+    size_t length_ = 0;
+    bool is_collision_free_ = true;
+};
+
+
+// Levenshtein distance kernels by Myers (1999) in the formulation of Hyyro (2001).
+namespace bit_parallel {
+
+    // Returns the distance between the pattern and text if it doesn't exceed bound, any greater value otherwise.
+    inline uint32_t Distance(const PatternMasks& pattern, std::wstring_view text,
+            uint32_t bound = std::numeric_limits<uint32_t>::max()) {
+        const uint64_t last = pattern.LastBit();
+        uint64_t pv = ~uint64_t(0);
+        uint64_t mv = 0;
+        int64_t score = static_cast<int64_t>(pattern.Length());
+        if (pattern.Length() == 0) {
+            return static_cast<uint32_t>(text.size());
+        }
+        for (size_t index = 0; index < text.size(); ++index) {
+            uint64_t eq = pattern.Get(text[index]);
+            uint64_t xv = eq | mv;
+            uint64_t xh = (((eq & pv) + pv) ^ pv) | eq;
+            uint64_t ph = mv | ~(xh | pv);
+            uint64_t mh = pv & xh;
+            score += (ph & last) != 0;
+            score -= (mh & last) != 0;
+            // the final score can't drop by more than one per remaining character
+            if (score - static_cast<int64_t>(text.size() - index - 1) > static_cast<int64_t>(bound)) {
+                return bound == std::numeric_limits<uint32_t>::max() ? bound : bound + 1;
+            }
+            ph = (ph << 1) | 1;
+            mh <<= 1;
+            pv = mh | ~(xv | ph);
+            mv = ph & xv;
+        }
+        return static_cast<uint32_t>(score);
+    }
+
+    inline void DistanceBatchScalar(const PatternMasks& pattern, const std::wstring_view* texts, size_t count,
+            uint32_t* distances) {
+        for (size_t index = 0; index < count; ++index) {
+            distances[index] = Distance(pattern, texts[index]);
+        }
+    }
+
+#ifdef BIT_PARALLEL_X86
+    constexpr size_t kBlockSize = 32;
+
+    // Looks up match masks of a block of text positions for every lane, lanes past their text end get zeros.
+    template <size_t Lanes>
+    inline void fill_block(const PatternMasks& pattern, const std::wstring_view* texts, size_t lanes,
+            size_t block, size_t block_length, uint64_t (*eq_block)[Lanes]) {
+        for (size_t lane = 0; lane < Lanes; ++lane) {
+            size_t filled = 0;
+            if (lane < lanes && texts[lane].size() > block) {
+                filled = std::min(block_length, texts[lane].size() - block);
+                const wchar_t* text = texts[lane].data() + block;
+                for (size_t step = 0; step < filled; ++step) {
+                    eq_block[step][lane] = pattern.Get(text[step]);
+                }
+            }
+            for (size_t step = filled; step < block_length; ++step) {
+                eq_block[step][lane] = 0;
+            }
+        }
+    }
+
+    // Scores up to four texts at once, one per 64-bit lane. Lanes stop accumulating score past their text end.
+    __attribute__((target("avx2")))
+    inline void DistanceBatchAvx2(const PatternMasks& pattern, const std::wstring_view* texts, size_t count,
+            uint32_t* distances) {
+        if (pattern.Length() == 0) {
+            DistanceBatchScalar(pattern, texts, count, distances);
+            return;
+        }
+        const __m256i ones = _mm256_set1_epi64x(-1);
+        const __m256i one = _mm256_set1_epi64x(1);
+        const __m256i zero = _mm256_setzero_si256();
+        const __m256i last = _mm256_set1_epi64x(static_cast<int64_t>(pattern.LastBit()));
+        for (size_t first = 0; first < count; first += 4) {
+            size_t lanes = std::min<size_t>(4, count - first);
+            size_t max_length = 0;
+            for (size_t lane = 0; lane < lanes; ++lane) {
+                max_length = std::max(max_length, texts[first + lane].size());
+            }
+            __m256i pv = ones;
+            __m256i mv = zero;
+            __m256i score = _mm256_set1_epi64x(static_cast<int64_t>(pattern.Length()));
+            __m256i lengths = _mm256_set_epi64x(
+                    lanes > 3 ? static_cast<int64_t>(texts[first + 3].size()) : 0,
+                    lanes > 2 ? static_cast<int64_t>(texts[first + 2].size()) : 0,
+                    lanes > 1 ? static_cast<int64_t>(texts[first + 1].size()) : 0,
+                    static_cast<int64_t>(texts[first].size()));
+            alignas(32) uint64_t eq_block[kBlockSize][4];
+            for (size_t block = 0; block < max_length; block += kBlockSize) {
+                size_t block_length = std::min(kBlockSize, max_length - block);
+                fill_block<4>(pattern, texts + first, lanes, block, block_length, eq_block);
+                for (size_t step = 0; step < block_length; ++step) {
+                    __m256i eq = _mm256_load_si256(reinterpret_cast<const __m256i*>(eq_block[step]));
+                    __m256i active = _mm256_cmpgt_epi64(lengths,
+                            _mm256_set1_epi64x(static_cast<int64_t>(block + step)));
+
+                    __m256i xv = _mm256_or_si256(eq, mv);
+                    __m256i xh = _mm256_or_si256(
+                            _mm256_xor_si256(_mm256_add_epi64(_mm256_and_si256(eq, pv), pv), pv), eq);
+                    __m256i ph = _mm256_or_si256(mv, _mm256_xor_si256(_mm256_or_si256(xh, pv), ones));
+                    __m256i mh = _mm256_and_si256(pv, xh);
+
+                    __m256i ph_zero = _mm256_cmpeq_epi64(_mm256_and_si256(ph, last), zero);
+                    __m256i mh_zero = _mm256_cmpeq_epi64(_mm256_and_si256(mh, last), zero);
+                    score = _mm256_add_epi64(score, _mm256_and_si256(_mm256_andnot_si256(ph_zero, active), one));
+                    score = _mm256_sub_epi64(score, _mm256_and_si256(_mm256_andnot_si256(mh_zero, active), one));
+
+                    ph = _mm256_or_si256(_mm256_slli_epi64(ph, 1), one);
+                    mh = _mm256_slli_epi64(mh, 1);
+                    pv = _mm256_or_si256(mh, _mm256_xor_si256(_mm256_or_si256(xv, ph), ones));
+                    mv = _mm256_and_si256(ph, xv);
+                }
+            }
+            alignas(32) uint64_t scores[4];
+            _mm256_store_si256(reinterpret_cast<__m256i*>(scores), score);
+            for (size_t lane = 0; lane < lanes; ++lane) {
+                distances[first + lane] = static_cast<uint32_t>(scores[lane]);
+            }
+        }
+    }
+
+    // Same as DistanceBatchAvx2 with two lanes per register.
+    __attribute__((target("sse4.2")))
+    inline void DistanceBatchSse4(const PatternMasks& pattern, const std::wstring_view* texts, size_t count,
+            uint32_t* distances) {
+        if (pattern.Length() == 0) {
+            DistanceBatchScalar(pattern, texts, count, distances);
+            return;
+        }
+        const __m128i ones = _mm_set1_epi64x(-1);
+        const __m128i one = _mm_set1_epi64x(1);
+        const __m128i zero = _mm_setzero_si128();
+        const __m128i last = _mm_set1_epi64x(static_cast<int64_t>(pattern.LastBit()));
+        for (size_t first = 0; first < count; first += 2) {
+            size_t lanes = std::min<size_t>(2, count - first);
+            size_t max_length = 0;
+            for (size_t lane = 0; lane < lanes; ++lane) {
+                max_length = std::max(max_length, texts[first + lane].size());
+            }
+            __m128i pv = ones;
+            __m128i mv = zero;
+            __m128i score = _mm_set1_epi64x(static_cast<int64_t>(pattern.Length()));
+            __m128i lengths = _mm_set_epi64x(
+                    lanes > 1 ? static_cast<int64_t>(texts[first + 1].size()) : 0,
+                    static_cast<int64_t>(texts[first].size()));
+            alignas(16) uint64_t eq_block[kBlockSize][2];
+            for (size_t block = 0; block < max_length; block += kBlockSize) {
+                size_t block_length = std::min(kBlockSize, max_length - block);
+                fill_block<2>(pattern, texts + first, lanes, block, block_length, eq_block);
+                for (size_t step = 0; step < block_length; ++step) {
+                    __m128i eq = _mm_load_si128(reinterpret_cast<const __m128i*>(eq_block[step]));
+                    __m128i active = _mm_cmpgt_epi64(lengths, _mm_set1_epi64x(static_cast<int64_t>(block + step)));
+
+                    __m128i xv = _mm_or_si128(eq, mv);
+                    __m128i xh = _mm_or_si128(_mm_xor_si128(_mm_add_epi64(_mm_and_si128(eq, pv), pv), pv), eq);
+                    __m128i ph = _mm_or_si128(mv, _mm_xor_si128(_mm_or_si128(xh, pv), ones));
+                    __m128i mh = _mm_and_si128(pv, xh);
+
+                    __m128i ph_zero = _mm_cmpeq_epi64(_mm_and_si128(ph, last), zero);
+                    __m128i mh_zero = _mm_cmpeq_epi64(_mm_and_si128(mh, last), zero);
+                    score = _mm_add_epi64(score, _mm_and_si128(_mm_andnot_si128(ph_zero, active), one));
+                    score = _mm_sub_epi64(score, _mm_and_si128(_mm_andnot_si128(mh_zero, active), one));
+
+                    ph = _mm_or_si128(_mm_slli_epi64(ph, 1), one);
+                    mh = _mm_slli_epi64(mh, 1);
+                    pv = _mm_or_si128(mh, _mm_xor_si128(_mm_or_si128(xv, ph), ones));
+                    mv = _mm_and_si128(ph, xv);
+                }
+            }
+            alignas(16) uint64_t scores[2];
+            _mm_store_si128(reinterpret_cast<__m128i*>(scores), score);
+            for (size_t lane = 0; lane < lanes; ++lane) {
+                distances[first + lane] = static_cast<uint32_t>(scores[lane]);
+            }
+        }
+    }
+#endif
+
+    using BatchKernel = void (*)(const PatternMasks&, const std::wstring_view*, size_t, uint32_t*);
+
+    inline BatchKernel SelectBatchKernel() {
+#ifdef BIT_PARALLEL_X86
+        __builtin_cpu_init();
+        if (__builtin_cpu_supports("avx2")) {
+            return DistanceBatchAvx2;
+        }
+        if (__builtin_cpu_supports("sse4.2")) {
+            return DistanceBatchSse4;
+        }
+#endif
+        return DistanceBatchScalar;
+    }
+
+    // Computes exact distances from the pattern to every text with the best kernel supported by the CPU.
+    inline const BatchKernel DistanceBatch = SelectBatchKernel();
+}
@@ -8,40 +8,43 @@
 #include <random>
 #include <unordered_map>
 #include <fstream>
+#include <future>
+#include <atomic>
+#include <thread>
+#include <mutex>
+#include <functional>
 
 #include <Poco/String.h>
 #include <Poco/Format.h>
 
 #include "metric.h"
-
-
-struct SearchResult {
-    std::wstring result;
-    uint32_t tolerance;
-    uint32_t priority;
-};
+#include "frozen_bk_tree.hpp"
+#include "dictionary.h"
+#include "dictionary_reader.h"
 
 
 class TreeNode {
 public:
     friend class BKTree;
+    friend class FrozenBKTree;
+    friend class ParallelTreeBuilder;
 
     TreeNode()
-        : data_(L""), priority_(1), max_dist_(0), min_dist_(std::numeric_limits<uint32_t>::max()) {
+        : data_(L""), priority_(1), is_deleted_(false), max_dist_(0) {
     }
 
     explicit TreeNode(std::wstring data, uint32_t priority=1)
-        : data_(std::move(data)), priority_(priority), max_dist_(0), min_dist_(std::numeric_limits<uint32_t>::max()) {
+        : data_(std::move(data)), priority_(priority), is_deleted_(false), max_dist_(0) {
     };
 
-    bool Insert(const std::wstring& new_data, uint32_t priority, AbstractWStringMetric& metric) {
-        uint32_t distance = metric(new_data, data_); // metric(new_data, data_);
+    bool Insert(const std::wstring& new_data, uint32_t priority, const AbstractWStringMetric& metric,
+            MetricWorkspace& workspace) {
+        uint32_t distance = metric(new_data, data_, workspace);
         if (distance != 0) {
             if (childs_.find(distance) != childs_.end()) {
-                return childs_[distance]->Insert(new_data, priority, metric);
+                return childs_[distance]->Insert(new_data, priority, metric, workspace);
             } else {
                 max_dist_ = std::max(max_dist_, distance);
-                min_dist_ = std::min(min_dist_, distance);
                 childs_[distance] = std::make_shared<TreeNode>(new_data, priority);
                 return true;
             }
@@ -51,95 +54,510 @@ public:
         }
     }
 
-    void FindSimilar(const std::wstring& data, uint32_t tolerance, std::vector<SearchResult>& results,
-            AbstractWStringMetric& metric) const {
-        uint32_t my_distance = metric(data, data_);
-        if (my_distance <= tolerance) {
-            results.emplace_back(SearchResult({data_, my_distance, priority_}));
+    // Copy-on-write insertion for trees visible to readers: copies the path to the word and shares all other
+    // subtrees with this one, which stays untouched. A deleted word is revived with the given priority.
+    std::shared_ptr<TreeNode> Inserted(const std::wstring& new_data, uint32_t priority,
+            const AbstractWStringMetric& metric, MetricWorkspace& workspace, bool& is_new) const {
+        auto copy = std::make_shared<TreeNode>(*this);
+        uint32_t distance = metric(new_data, data_, workspace);
+        if (distance == 0) {
+            is_new = is_deleted_;
+            copy->priority_ = is_deleted_ ? priority : priority_ + priority;
+            copy->is_deleted_ = false;
+            return copy;
+        }
+        auto child = childs_.find(distance);
+        if (child != childs_.end()) {
+            copy->childs_[distance] = child->second->Inserted(new_data, priority, metric, workspace, is_new);
+        } else {
+            is_new = true;
+            copy->max_dist_ = std::max(max_dist_, distance);
+            copy->childs_[distance] = std::make_shared<TreeNode>(new_data, priority);
         }
-        uint32_t start = (my_distance < tolerance) ?
-                min_dist_ : std::max(my_distance - tolerance, min_dist_);
-        uint32_t end = std::min(my_distance + tolerance, max_dist_);
-        for (uint32_t dist = start; dist <= end; ++dist) {
-            auto child = childs_.find(dist);
-            if (child != childs_.end()) {
-                child->second->FindSimilar(data, tolerance, results, metric);
+        return copy;
+    }
+
+    // Copy-on-write counterpart of Inserted for existing words, nullptr if the word is absent or deleted.
+    std::shared_ptr<TreeNode> Updated(const std::wstring& word, const std::function<void(TreeNode&)>& update,
+            const AbstractWStringMetric& metric, MetricWorkspace& workspace) const {
+        uint32_t distance = metric(word, data_, workspace);
+        if (distance == 0) {
+            if (is_deleted_) {
+                return nullptr;
             }
+            auto copy = std::make_shared<TreeNode>(*this);
+            update(*copy);
+            return copy;
+        }
+        auto child = childs_.find(distance);
+        if (child == childs_.end()) {
+            return nullptr;
+        }
+        auto updated_child = child->second->Updated(word, update, metric, workspace);
+        if (updated_child == nullptr) {
+            return nullptr;
+        }
+        auto copy = std::make_shared<TreeNode>(*this);
+        copy->childs_[distance] = std::move(updated_child);
+        return copy;
+    }
+
+    // Expects the query to be prepared with metric.Prepare in the workspace. Walks the tree with an explicit stack
+    // of plain pointers, the caller's reference to this node keeps all of them alive.
+    void FindSimilar(SearchResultCollector& results, const AbstractWStringMetric& metric,
+            MetricWorkspace& workspace) const {
+        // a child is worth visiting while its distance to the parent is within tolerance of the query's one,
+        // which is checked again when it's popped, as a limited search may have tightened the tolerance since
+        struct Entry {
+            const TreeNode* node;
+            uint32_t edge;
+            uint32_t parent_distance;
+        };
+        static thread_local std::vector<Entry> stack;
+        stack.clear();
+        stack.push_back({this, 0, 0});
+        while (!stack.empty()) {
+            Entry entry = stack.back();
+            stack.pop_back();
+            if (!stack.empty()) {
+                // the prefetch made when it was pushed may be evicted by now, unless it's a sibling just pushed
+                __builtin_prefetch(stack.back().node);
+            }
+            uint32_t tolerance = results.Tolerance();
+            if (difference(entry.edge, entry.parent_distance) > tolerance) {
+                results.CountPruned(1);
+                continue;
+            }
+            if (!results.Visit()) {
+                break;
+            }
+            const TreeNode& node = *entry.node;
+            uint32_t cutoff = (node.max_dist_ > std::numeric_limits<uint32_t>::max() - tolerance) ?
+                    std::numeric_limits<uint32_t>::max() : node.max_dist_ + tolerance;
+            uint32_t my_distance = metric.QueryBounded(node.data_, cutoff, workspace);
+            results.CountEvaluations(1);
+            if (my_distance > cutoff) {
+                results.CountPruned(1);
+                continue;
+            }
+            if (my_distance <= tolerance && !node.is_deleted_) {
+                results.Add(node.data_, my_distance, node.priority_);
+                tolerance = results.Tolerance();
+            }
+            // only the children there are, rather than every distance in the range
+            size_t descended = 0;
+            for (const auto& [distance, child]: node.childs_) {
+                if (difference(distance, my_distance) <= tolerance) {
+                    __builtin_prefetch(child.get());
+                    stack.push_back({child.get(), distance, my_distance});
+                    ++descended;
+                }
+            }
+            results.CountPruned(node.childs_.size() - descended);
         }
     }
 
 private:
+    static uint32_t difference(uint32_t distance, uint32_t other) {
+        return std::max(distance, other) - std::min(distance, other);
+    }
+
     std::wstring data_;
     uint32_t priority_;
+    // deleted words stay in the tree to keep it valid and are skipped in search results
+    bool is_deleted_;
     std::unordered_map<uint32_t, std::shared_ptr<TreeNode>> childs_;
-    uint32_t max_dist_, min_dist_;
+    uint32_t max_dist_;
 };
 
 
-class BKTree {
+FrozenBKTree::FrozenBKTree(const TreeNode& root, const AbstractWStringMetric& metric) {
+    std::vector<const TreeNode*> queue = {&root};
+    std::vector<uint32_t> deleted;
+    distance_storage_.push_back(0);
+    for (size_t index = 0; index < queue.size(); ++index) {
+        const TreeNode* tree_node = queue[index];
+        if (word_storage_.size() + tree_node->data_.size() > std::numeric_limits<uint32_t>::max()) {
+            throw std::runtime_error("Dictionary is too large to be frozen");
+        }
+        Node node{};
+        node.word_offset = static_cast<uint32_t>(word_storage_.size());
+        node.word_length = static_cast<uint32_t>(tree_node->data_.size());
+        node.priority = tree_node->priority_;
+        node.first_child = static_cast<uint32_t>(queue.size());
+        node.child_count = static_cast<uint32_t>(tree_node->childs_.size());
+        if (tree_node->is_deleted_) {
+            deleted.push_back(static_cast<uint32_t>(index));
+        }
+        word_storage_.insert(word_storage_.end(), tree_node->data_.begin(), tree_node->data_.end());
+        node_storage_.push_back(node);
+        SubtreeSignature signature{0, 0, node.word_length, node.word_length};
+        for (wchar_t ch: tree_node->data_) {
+            signature.any_classes |= SubtreeSignature::ClassBit(metric.CharKey(ch));
+        }
+        signature.all_classes = signature.any_classes;
+        signature_storage_.push_back(signature);
+
+        std::vector<std::pair<uint32_t, const TreeNode*>> childs;
+        childs.reserve(tree_node->childs_.size());
+        for (const auto& [distance, child]: tree_node->childs_) {
+            childs.emplace_back(distance, child.get());
+        }
+        std::sort(childs.begin(), childs.end());
+        for (const auto& [distance, child]: childs) {
+            queue.push_back(child);
+            distance_storage_.push_back(distance);
+        }
+    }
+    // children follow their parents, so a backward pass sees every subtree complete before merging it up
+    for (size_t index = node_storage_.size(); index-- > 0;) {
+        const Node& node = node_storage_[index];
+        SubtreeSignature& signature = signature_storage_[index];
+        for (uint32_t child = node.first_child; child < node.first_child + node.child_count; ++child) {
+            const SubtreeSignature& child_signature = signature_storage_[child];
+            signature.any_classes |= child_signature.any_classes;
+            signature.all_classes &= child_signature.all_classes;
+            signature.min_length = std::min(signature.min_length, child_signature.min_length);
+            signature.max_length = std::max(signature.max_length, child_signature.max_length);
+        }
+    }
+    node_storage_.shrink_to_fit();
+    signature_storage_.shrink_to_fit();
+    word_storage_.shrink_to_fit();
+    attach_storage();
+    for (uint32_t node_index: deleted) {
+        Update(node_index, nodes_[node_index].priority, true);
+    }
+}
+
+
+// Builds the same tree as inserting words one by one in their order would. Words are partitioned by distance
+// to the subtree root and partitions are built recursively, large ones on separate threads.
+class ParallelTreeBuilder {
 public:
-    BKTree() : metric_(std::make_shared<LevensteinMetric>()), root_(nullptr) {};
-    BKTree(const std::string& dictionary_file_name, std::shared_ptr<AbstractWStringMetric> metric)
-            : metric_(std::move(metric)), root_(nullptr) {
-        std::wifstream input_file(dictionary_file_name);
-        if (!input_file) {
-            throw std::runtime_error(
-                    Poco::format("Dictionary file \"%s\" can't be opened",
-                                 dictionary_file_name));
-        }
-        input_file.imbue(std::locale(""));
-        std::vector<std::pair<std::wstring, uint32_t>> words;
-        std::wstring word;
-        uint32_t priority;
-        std::cerr << Poco::format("Reading dictionary from %s... ", dictionary_file_name);
-        while (input_file >> word >> priority) {
-            if (word.length() > 0) {
-                word = Poco::toLower(word);
-                words.emplace_back(word, priority);
+    ParallelTreeBuilder(const AbstractWStringMetric& metric, size_t threads_count)
+        : metric_(metric), threads_count_(std::max<size_t>(1, threads_count)), busy_threads_(1) {
+    }
+
+    std::shared_ptr<TreeNode> Build(DictionaryEntries words) {
+        if (words.empty()) {
+            return nullptr;
+        }
+        return build_subtree(std::move(words));
+    }
+
+private:
+    static constexpr size_t kMinParallelSize = 1 << 12;
+
+    bool try_acquire_thread() {
+        size_t busy = busy_threads_.load();
+        while (busy < threads_count_) {
+            if (busy_threads_.compare_exchange_weak(busy, busy + 1)) {
+                return true;
             }
         }
-        std::cerr << "Done!" << std::endl;
-        input_file.close();
+        return false;
+    }
 
-        std::random_device rd;
-        std::mt19937 mt(rd());
-        std::shuffle(words.begin(), words.end(), mt);
-        size_t index = 0;
-        for (const auto& [elem, priority]: words) {
-            Insert(elem, priority);
-            ++index;
-            if (index % 1000 == 0) {
-                std::wcerr << "\rBuilding bk_tree: " << index << "/" << words.size();
+    void release_thread() {
+        --busy_threads_;
+    }
+
+    std::shared_ptr<TreeNode> build_subtree(DictionaryEntries words) {
+        static thread_local MetricWorkspace workspace;
+        auto root = std::make_shared<TreeNode>(std::move(words[0].first), words[0].second);
+        if (words.size() < kMinParallelSize) {
+            for (size_t index = 1; index < words.size(); ++index) {
+                root->Insert(words[index].first, words[index].second, metric_, workspace);
             }
+            return root;
         }
-        std::cerr << "\rBuilding bk_tree: " << words.size() << "/" << words.size();
-        std::cerr << " Done!" << std::endl;
+
+        std::vector<uint32_t> distances = get_distances(root->data_, words);
+        std::map<uint32_t, DictionaryEntries> partitions;
+        for (size_t index = 1; index < words.size(); ++index) {
+            if (distances[index] == 0) {
+                root->priority_ += words[index].second;
+            } else {
+                partitions[distances[index]].push_back(std::move(words[index]));
+            }
+        }
+        DictionaryEntries().swap(words);
+
+        std::vector<std::pair<uint32_t, std::future<std::shared_ptr<TreeNode>>>> pending;
+        for (auto& [distance, partition]: partitions) {
+            root->max_dist_ = std::max(root->max_dist_, distance);
+            if (partition.size() >= kMinParallelSize && try_acquire_thread()) {
+                pending.emplace_back(distance, std::async(std::launch::async,
+                        [this, partition = std::move(partition)]() mutable {
+                            auto subtree = build_subtree(std::move(partition));
+                            release_thread();
+                            return subtree;
+                        }));
+            } else {
+                root->childs_[distance] = build_subtree(std::move(partition));
+            }
+        }
+        for (auto& [distance, subtree]: pending) {
+            root->childs_[distance] = subtree.get();
+        }
+        return root;
     }
 
-    bool Insert(const std::wstring& data, uint32_t priority=1) {
-        if (root_ != nullptr) {
-            return root_->Insert(data, priority, *metric_);
-        } else {
-            root_ = std::make_shared<TreeNode>(data, priority);
+    // Distances from root to every word but the first one, computed on all threads available at the moment.
+    std::vector<uint32_t> get_distances(const std::wstring& root, const DictionaryEntries& words) {
+        std::vector<uint32_t> distances(words.size(), 0);
+        auto compute = [this, &root, &words, &distances](size_t begin, size_t end) {
+            static thread_local MetricWorkspace workspace;
+            for (size_t index = begin; index < end; ++index) {
+                distances[index] = metric_(root, words[index].first, workspace);
+            }
+        };
+        size_t chunks_count = 1;
+        while (chunks_count < words.size() / kMinParallelSize && try_acquire_thread()) {
+            ++chunks_count;
+        }
+        size_t chunk_size = (words.size() + chunks_count - 1) / chunks_count;
+        std::vector<std::future<void>> pending;
+        for (size_t chunk = 1; chunk < chunks_count; ++chunk) {
+            size_t begin = std::min(words.size(), chunk * chunk_size);
+            size_t end = std::min(words.size(), begin + chunk_size);
+            pending.push_back(std::async(std::launch::async, [this, &compute, begin, end]() {
+                compute(begin, end);
+                release_thread();
+            }));
+        }
+        compute(1, std::min(words.size(), chunk_size));
+        for (auto& future: pending) {
+            future.get();
+        }
+        return distances;
+    }
+
+    const AbstractWStringMetric& metric_;
+    size_t threads_count_;
+    std::atomic<size_t> busy_threads_;
+};
+
+
+// Frozen base tree with a copy-on-write delta tree for words inserted later. Updates are serialized by a mutex
+// and published atomically, so searches never wait for them and always see a consistent tree.
+class BKTree : public Dictionary {
+    friend class SymSpellIndex;
+public:
+    static constexpr uint32_t kShuffleSeed = 20200513;
+
+    BKTree() : metric_(std::make_shared<LevensteinMetric>()) {};
+    BKTree(const std::string& dictionary_file_name, std::shared_ptr<const AbstractWStringMetric> metric,
+            size_t threads_count = std::thread::hardware_concurrency())
+            : BKTree(Read(dictionary_file_name, threads_count), std::move(metric), threads_count) {
+    }
+
+    // Builds the tree of words already read, such as a shard of a dictionary.
+    BKTree(DictionaryEntries words, std::shared_ptr<const AbstractWStringMetric> metric,
+            size_t threads_count = std::thread::hardware_concurrency())
+            : metric_(std::move(metric)) {
+        threads_count = std::max<size_t>(1, threads_count);
+        // Any order without long runs of similar words keeps the tree balanced. A fixed one, independent of how
+        // the reader split the file, builds the same tree every time, so timings and index files are reproducible.
+        std::sort(words.begin(), words.end());
+        std::mt19937 mt(kShuffleSeed);
+        std::shuffle(words.begin(), words.end(), mt);
+        std::cerr << Poco::format("Building bk_tree on %z threads... ", threads_count);
+        delta_ = ParallelTreeBuilder(*metric_, threads_count).Build(std::move(words));
+        std::cerr << "Done!" << std::endl;
+
+        std::cerr << "Freezing bk_tree... ";
+        Freeze();
+        std::cerr << "Done!" << std::endl;
+    }
+
+    // Serves queries from an index file previously written by SaveIndex.
+    BKTree(std::shared_ptr<const AbstractWStringMetric> metric, const std::string& index_file_name)
+            : metric_(std::move(metric)) {
+        std::cerr << Poco::format("Mapping bk_tree index from %s... ", index_file_name);
+        frozen_ = FrozenBKTree::Load(index_file_name, metric_->Identity());
+        std::cerr << Poco::format("Done! %z words", frozen_->Size()) << std::endl;
+        if (frozen_->Size() == 0) {
+            frozen_.reset();
+        }
+    }
+
+    static DictionaryEntries Read(const std::string& dictionary_file_name,
+            size_t threads_count = std::thread::hardware_concurrency()) {
+        std::cerr << Poco::format("Reading dictionary from %s... ", dictionary_file_name);
+        auto words = ReadDictionary(dictionary_file_name, std::max<size_t>(1, threads_count));
+        std::cerr << Poco::format("Done! %z unique words", words.size()) << std::endl;
+        return words;
+    }
+
+    // An empty tree is saved as an index without nodes, such as a shard no word hashed to.
+    void SaveIndex(const std::string& index_file_name) {
+        Freeze();
+        if (std::atomic_load(&delta_) != nullptr) {
+            throw std::runtime_error("Can't save bk_tree with words inserted after freezing");
+        }
+        if (frozen_ == nullptr) {
+            FrozenBKTree().Save(index_file_name, metric_->Identity());
+            return;
+        }
+        frozen_->Save(index_file_name, metric_->Identity());
+    }
+
+    bool Insert(const std::wstring& data, uint32_t priority=1) override {
+        std::lock_guard<std::mutex> lock(update_mutex_);
+        if (frozen_ != nullptr) {
+            uint32_t node_index = frozen_->Find(data, *metric_, workspace_);
+            if (node_index != FrozenBKTree::kNotFound) {
+                bool is_deleted = frozen_->IsDeleted(node_index);
+                frozen_->Update(node_index, is_deleted ? priority : frozen_->Priority(node_index) + priority, false);
+                ++version_;
+                return is_deleted;
+            }
+        }
+        auto delta = std::atomic_load(&delta_);
+        if (delta == nullptr) {
+            std::atomic_store(&delta_, std::make_shared<TreeNode>(data, priority));
+            ++version_;
             return true;
         }
+        bool is_new = false;
+        std::atomic_store(&delta_, delta->Inserted(data, priority, *metric_, workspace_, is_new));
+        ++version_;
+        return is_new;
     }
 
-    [[nodiscard]] std::vector<SearchResult> FindSimilar(const std::wstring& data, uint32_t tolerance) const {
-        if (root_ == nullptr) {
-            return {};
+    bool IncreasePriority(const std::wstring& data, uint32_t priority) override {
+        std::lock_guard<std::mutex> lock(update_mutex_);
+        if (frozen_ != nullptr) {
+            uint32_t node_index = frozen_->Find(data, *metric_, workspace_);
+            if (node_index != FrozenBKTree::kNotFound) {
+                if (frozen_->IsDeleted(node_index)) {
+                    return false;
+                }
+                frozen_->Update(node_index, frozen_->Priority(node_index) + priority, false);
+                ++version_;
+                return true;
+            }
         }
-        std::vector<SearchResult> result;
-        root_->FindSimilar(data, tolerance, result, *metric_);
-        std::sort(result.begin(), result.end(), [](const auto& _1, const auto& _2) -> bool {
-            return _1.tolerance != _2.tolerance ? _1.tolerance < _2.tolerance : _1.priority > _2.priority;
+        return update_delta(data, [priority](TreeNode& node) {
+            node.priority_ += priority;
         });
-        return result;
+    }
+
+    bool Delete(const std::wstring& data) override {
+        std::lock_guard<std::mutex> lock(update_mutex_);
+        if (frozen_ != nullptr) {
+            uint32_t node_index = frozen_->Find(data, *metric_, workspace_);
+            if (node_index != FrozenBKTree::kNotFound) {
+                if (frozen_->IsDeleted(node_index)) {
+                    return false;
+                }
+                frozen_->Update(node_index, frozen_->Priority(node_index), true);
+                ++version_;
+                return true;
+            }
+        }
+        return update_delta(data, [](TreeNode& node) {
+            node.is_deleted_ = true;
+        });
+    }
+
+    [[nodiscard]] uint64_t Version() const override {
+        return version_.load();
+    }
+
+    // Converts the tree into the compact immutable layout, which is used for all subsequent queries.
+    // Must not run concurrently with other calls. Once frozen, inserted words go to the delta tree.
+    void Freeze() {
+        if (delta_ == nullptr || frozen_ != nullptr) {
+            return;
+        }
+        frozen_ = std::make_unique<FrozenBKTree>(*delta_, *metric_);
+        delta_.reset();
+    }
+
+    // Nonzero limit lets the search skip subtrees unable to improve the best results found.
+    [[nodiscard]] std::vector<SearchResult> FindSimilar(const std::wstring& data, uint32_t tolerance,
+            size_t limit = 0) const override {
+        static thread_local MetricWorkspace workspace;
+        return FindSimilar(data, tolerance, limit, workspace);
+    }
+
+    // Safe to call concurrently as long as every caller passes its own workspace.
+    [[nodiscard]] std::vector<SearchResult> FindSimilar(const std::wstring& data, uint32_t tolerance, size_t limit,
+            MetricWorkspace& workspace) const {
+        SearchResultCollector results(tolerance, limit);
+        if (frozen_ != nullptr) {
+            frozen_->FindSimilar(data, results, *metric_, workspace);
+        }
+        find_in_delta(data, results, workspace);
+        return results.Release();
+    }
+
+    // Searches for all queries walking the frozen tree once for every kMaxBatchQueries of them, which
+    // shares loading and scoring of upper nodes between queries. Results are in the order of queries.
+    [[nodiscard]] std::vector<SearchOutcome> FindSimilar(const std::vector<SearchQuery>& queries) const override {
+        static thread_local MetricWorkspace workspace;
+        return FindSimilar(queries, workspace);
+    }
+
+    [[nodiscard]] std::vector<SearchOutcome> FindSimilar(const std::vector<SearchQuery>& queries,
+            MetricWorkspace& workspace) const {
+        std::vector<SearchResultCollector> results;
+        std::vector<std::wstring_view> words;
+        results.reserve(queries.size());
+        words.reserve(queries.size());
+        for (const auto& query: queries) {
+            results.emplace_back(query.tolerance, query.limit, query.deadline_ms, query.max_nodes_visited);
+            words.emplace_back(query.word);
+        }
+        if (frozen_ != nullptr && queries.size() == 1) {
+            frozen_->FindSimilar(words[0], results[0], *metric_, workspace);
+        } else if (frozen_ != nullptr) {
+            for (size_t first = 0; first < queries.size(); first += FrozenBKTree::kMaxBatchQueries) {
+                frozen_->FindSimilarBatch(words.data() + first, results.data() + first,
+                        std::min(FrozenBKTree::kMaxBatchQueries, queries.size() - first), *metric_, workspace);
+            }
+        }
+        std::vector<SearchOutcome> released;
+        released.reserve(queries.size());
+        for (size_t index = 0; index < queries.size(); ++index) {
+            find_in_delta(queries[index].word, results[index], workspace);
+            released.push_back({results[index].Release(), results[index].IsTruncated(), results[index].Stats()});
+        }
+        return released;
     }
 
 private:
-    std::shared_ptr<AbstractWStringMetric> metric_;
-    std::shared_ptr<TreeNode> root_;
-};
+    // Adds words inserted after freezing, unless the budget of the search has run out.
+    void find_in_delta(const std::wstring& data, SearchResultCollector& results, MetricWorkspace& workspace) const {
+        auto delta = std::atomic_load(&delta_);
+        if (delta != nullptr && !results.IsTruncated()) {
+            metric_->Prepare(data, workspace);
+            delta->FindSimilar(results, *metric_, workspace);
+        }
+    }
 
+    bool update_delta(const std::wstring& data, const std::function<void(TreeNode&)>& update) {
+        auto delta = std::atomic_load(&delta_);
+        if (delta == nullptr) {
+            return false;
+        }
+        auto updated = delta->Updated(data, update, *metric_, workspace_);
+        if (updated == nullptr) {
+            return false;
+        }
+        std::atomic_store(&delta_, std::move(updated));
+        ++version_;
+        return true;
+    }
 
+    std::shared_ptr<const AbstractWStringMetric> metric_;
+    std::unique_ptr<FrozenBKTree> frozen_;
+    // accessed with atomic_load/atomic_store only, published trees are never modified
+    std::shared_ptr<TreeNode> delta_;
+    std::mutex update_mutex_;
+    std::atomic<uint64_t> version_{0};
+    MetricWorkspace workspace_;
+};
@@ -1,36 +1,131 @@
 #pragma once
 
+#include <algorithm>
+#include <atomic>
 #include <iostream>
+#include <memory>
+#include <mutex>
 #include <vector>
 #include <unordered_map>
 
-template <typename T, class Hash = std::hash<T>>
-class BloomCache {
+// Concurrent cache with CLOCK eviction. Keys are spread over shards locked independently, so threads rarely
+// wait for each other, and every shard holds at most its share of the capacity. A cache of capacity 0 stores nothing.
+template <typename Key, typename Value, class Hash = std::hash<Key>>
+class ShardedClockCache {
 public:
-    explicit BloomCache(size_t bits=16) : cache_(1 << bits, false), mask_((1 << bits) - 1) {
+    explicit ShardedClockCache(size_t capacity, size_t shards_count = 16)
+        : shards_count_(std::max<size_t>(1, std::min(shards_count, capacity))),
+          shard_capacity_(capacity == 0 ? 0 : std::max<size_t>(1, capacity / shards_count_)),
+          shards_(new Shard[shards_count_]) {
+        for (size_t index = 0; index < shards_count_; ++index) {
+            shards_[index].entries.reserve(shard_capacity_);
+        }
     }
 
-    bool Check(const T& value) const {
-        size_t hash = Hash()(value);
-        size_t h1 = (hash << 2) ^ (hash);
-        size_t h2 = (hash >> 2) ^ (hash);
-        // size_t h3 = (hash >> 2) ^ (hash << 2);
+    bool Get(const Key& key, Value& value) {
+        Shard& shard = get_shard(key);
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        auto position = shard.index.find(key);
+        if (position == shard.index.end()) {
+            shard.misses.fetch_add(1, std::memory_order_relaxed);
+            return false;
+        }
+        Entry& entry = shard.entries[position->second];
+        entry.is_referenced = true;
+        value = entry.value;
+        shard.hits.fetch_add(1, std::memory_order_relaxed);
+        return true;
+    }
+
+    void Put(const Key& key, Value value) {
+        if (shard_capacity_ == 0) {
+            return;
+        }
+        Shard& shard = get_shard(key);
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        auto position = shard.index.find(key);
+        if (position != shard.index.end()) {
+            shard.entries[position->second].value = std::move(value);
+            return;
+        }
+        if (shard.entries.size() < shard_capacity_) {
+            shard.index.emplace(key, shard.entries.size());
+            shard.entries.push_back(Entry{key, std::move(value), false});
+            return;
+        }
+        // the hand clears reference bits until it finds an entry not used since its last pass
+        while (shard.entries[shard.hand].is_referenced) {
+            shard.entries[shard.hand].is_referenced = false;
+            shard.hand = (shard.hand + 1) % shard.entries.size();
+        }
+        Entry& victim = shard.entries[shard.hand];
+        shard.index.erase(victim.key);
+        shard.index.emplace(key, shard.hand);
+        victim = Entry{key, std::move(value), false};
+        shard.hand = (shard.hand + 1) % shard.entries.size();
+    }
+
+    void Clear() {
+        for (size_t index = 0; index < shards_count_; ++index) {
+            std::lock_guard<std::mutex> lock(shards_[index].mutex);
+            shards_[index].entries.clear();
+            shards_[index].index.clear();
+            shards_[index].hand = 0;
+        }
+    }
+
+    [[nodiscard]] uint64_t Hits() const {
+        uint64_t hits = 0;
+        for (size_t index = 0; index < shards_count_; ++index) {
+            hits += shards_[index].hits.load(std::memory_order_relaxed);
+        }
+        return hits;
+    }
 
-        return cache_[h1 & mask_] && cache_[h2 & mask_]; // && cache_[h3 & mask_];
+    [[nodiscard]] uint64_t Misses() const {
+        uint64_t misses = 0;
+        for (size_t index = 0; index < shards_count_; ++index) {
+            misses += shards_[index].misses.load(std::memory_order_relaxed);
+        }
+        return misses;
     }
 
+    [[nodiscard]] size_t Size() const {
+        size_t size = 0;
+        for (size_t index = 0; index < shards_count_; ++index) {
+            std::lock_guard<std::mutex> lock(shards_[index].mutex);
+            size += shards_[index].entries.size();
+        }
+        return size;
+    }
 
-    void Add(const T& value) {
-        size_t hash = Hash()(value);
-        size_t h1 = (hash << 2) ^ (hash);
-        size_t h2 = (hash >> 2) ^ (hash);
-        // size_t h3 = (hash >> 2) ^ (hash << 2);
-        cache_[h1 & mask_] = true;
-        cache_[h2 & mask_] = true;
-        // cache_[h3 & mask_] = true;
+    [[nodiscard]] size_t Capacity() const {
+        return shards_count_ * shard_capacity_;
     }
 
 private:
-    std::vector<bool> cache_;
-    size_t mask_;
-};
\ No newline at end of file
+    struct Entry {
+        Key key;
+        Value value;
+        bool is_referenced;
+    };
+
+    // aligned to keep locks and counters of different shards on different cache lines
+    struct alignas(64) Shard {
+        mutable std::mutex mutex;
+        std::vector<Entry> entries;
+        std::unordered_map<Key, size_t, Hash> index;
+        size_t hand = 0;
+        std::atomic<uint64_t> hits{0};
+        std::atomic<uint64_t> misses{0};
+    };
+
+    Shard& get_shard(const Key& key) {
+        size_t hash = Hash()(key);
+        return shards_[(hash ^ (hash >> 29)) % shards_count_];
+    }
+
+    size_t shards_count_;
+    size_t shard_capacity_;
+    std::unique_ptr<Shard[]> shards_;
+};
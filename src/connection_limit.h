@@ -0,0 +1,61 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <string>
+
+#include <Poco/AutoPtr.h>
+#include <Poco/Exception.h>
+#include <Poco/Net/StreamSocket.h>
+#include <Poco/Net/TCPServer.h>
+#include <Poco/Net/TCPServerConnectionFilter.h>
+
+
+// Bounds the connections of a server waiting for a connection thread. Connections past the limit get the rejection,
+// if there is one, and are closed at once by the accepting thread, instead of waiting behind clients which hold
+// every thread. While all threads are taken, handlers should close their connections after answering, so that
+// threads go to the queued connections rather than to idle keep-alive clients.
+class ConnectionLimit : public Poco::Net::TCPServerConnectionFilter {
+public:
+    ConnectionLimit(int max_queued, std::string rejection)
+        : max_queued_(max_queued), rejection_(std::move(rejection)) {
+    }
+
+    // Must be called before the server starts, connections are accepted unconditionally until then.
+    void Attach(const Poco::Net::TCPServer& server) {
+        server_ = &server;
+    }
+
+    // Whether every connection thread is taken, so a new connection would wait in the queue.
+    [[nodiscard]] bool IsSaturated() const {
+        return server_ != nullptr &&
+               (server_->queuedConnections() > 0 || server_->currentThreads() >= server_->maxThreads());
+    }
+
+    [[nodiscard]] uint64_t Rejected() const {
+        return rejected_.load();
+    }
+
+    bool accept(const Poco::Net::StreamSocket& socket) override {
+        if (server_ == nullptr || server_->queuedConnections() < max_queued_) {
+            return true;
+        }
+        ++rejected_;
+        if (!rejection_.empty()) {
+            // a fresh socket has room for a short response in its send buffer, so this doesn't block accepting
+            try {
+                Poco::Net::StreamSocket client(socket);
+                client.sendBytes(rejection_.data(), static_cast<int>(rejection_.size()));
+                client.shutdownSend();
+            } catch (Poco::Exception&) {
+            }
+        }
+        return false;
+    }
+
+private:
+    const int max_queued_;
+    const std::string rejection_;
+    const Poco::Net::TCPServer* server_ = nullptr;
+    std::atomic<uint64_t> rejected_{0};
+};
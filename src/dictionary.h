@@ -0,0 +1,33 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "frozen_bk_tree.hpp"
+
+
+// Searchable dictionary with online updates as served by the front ends. Implemented by the search engines,
+// which may be selected with --engine.
+class Dictionary {
+public:
+    virtual ~Dictionary() = default;
+
+    // Adds the word or increases its priority, a deleted word is revived with the given priority.
+    // Returns true if the word wasn't in the dictionary.
+    virtual bool Insert(const std::wstring& data, uint32_t priority=1) = 0;
+    // Returns false if there is no such word.
+    virtual bool IncreasePriority(const std::wstring& data, uint32_t priority) = 0;
+    // Returns false if there is no such word.
+    virtual bool Delete(const std::wstring& data) = 0;
+
+    // Number of updates applied so far, incremented after every update becomes visible to searches.
+    [[nodiscard]] virtual uint64_t Version() const = 0;
+
+    // Returns words within tolerance ordered by distance, then by priority, at most limit of them if it's nonzero.
+    [[nodiscard]] virtual std::vector<SearchResult> FindSimilar(const std::wstring& data, uint32_t tolerance,
+            size_t limit = 0) const = 0;
+
+    // Results are in the order of queries.
+    [[nodiscard]] virtual std::vector<SearchOutcome> FindSimilar(const std::vector<SearchQuery>& queries) const = 0;
+};
@@ -0,0 +1,186 @@
+#pragma once
+
+#include <atomic>
+#include <functional>
+#include <future>
+#include <limits>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include <Poco/Format.h>
+
+#include "dictionary.h"
+
+
+// Owns the dictionary being served and replaces it with a freshly loaded one on Reload. Requests take a snapshot
+// with Get, so the ones in flight finish on the generation they started with, which is freed after them.
+class DictionaryHolder {
+public:
+    using Loader = std::function<std::shared_ptr<Dictionary>()>;
+
+    explicit DictionaryHolder(Loader loader)
+        : loader_(std::move(loader)), dictionary_(loader_()), generation_(1) {
+    }
+
+    [[nodiscard]] std::shared_ptr<Dictionary> Get() const {
+        return std::atomic_load(&dictionary_);
+    }
+
+    // Incremented on every successful reload.
+    [[nodiscard]] uint64_t Generation() const {
+        return generation_.load();
+    }
+
+    // Loads a new dictionary while the current one keeps serving and swaps them. Returns false if another reload
+    // is in progress. If loading throws, the current dictionary stays in place.
+    bool Reload() {
+        std::unique_lock<std::mutex> lock(reload_mutex_, std::try_to_lock);
+        if (!lock.owns_lock()) {
+            return false;
+        }
+        auto dictionary = loader_();
+        std::atomic_store(&dictionary_, std::move(dictionary));
+        ++generation_;
+        return true;
+    }
+
+private:
+    Loader loader_;
+    // accessed with atomic_load/atomic_store only
+    std::shared_ptr<Dictionary> dictionary_;
+    std::atomic<uint64_t> generation_;
+    std::mutex reload_mutex_;
+};
+
+
+// Named dictionaries served by one process, each with its own holder, so with its own metric and generation.
+// Requests refer to them by name, and to the default one when they don't name any.
+class DictionaryRegistry {
+public:
+    static constexpr const char* kDefaultName = "default";
+
+    using NamedLoaders = std::vector<std::pair<std::string, DictionaryHolder::Loader>>;
+
+    // Loads all dictionaries in parallel. The default one is named kDefaultName or else given first.
+    explicit DictionaryRegistry(NamedLoaders loaders) {
+        if (loaders.empty()) {
+            throw std::runtime_error("No dictionaries to serve");
+        }
+        std::vector<std::future<std::shared_ptr<DictionaryHolder>>> holders;
+        for (auto& [name, loader]: loaders) {
+            if (!indices_.emplace(name, static_cast<uint32_t>(names_.size())).second) {
+                throw std::runtime_error(Poco::format("Dictionary \"%s\" is given twice", name));
+            }
+            names_.push_back(name);
+            holders.push_back(std::async(std::launch::async, [loader = std::move(loader)]() {
+                return std::make_shared<DictionaryHolder>(loader);
+            }));
+        }
+        // every load is waited for before the first failure is rethrown
+        std::exception_ptr error;
+        for (auto& holder: holders) {
+            try {
+                holders_.push_back(holder.get());
+            } catch (...) {
+                error = error == nullptr ? std::current_exception() : error;
+            }
+        }
+        if (error != nullptr) {
+            std::rethrow_exception(error);
+        }
+        auto default_index = indices_.find(kDefaultName);
+        default_index_ = default_index == indices_.end() ? 0 : default_index->second;
+    }
+
+    [[nodiscard]] size_t Size() const {
+        return holders_.size();
+    }
+
+    static constexpr uint32_t kNotFound = std::numeric_limits<uint32_t>::max();
+
+    // Index of the named dictionary or kNotFound, an empty name stands for the default dictionary.
+    [[nodiscard]] uint32_t Find(const std::string& name) const {
+        if (name.empty()) {
+            return default_index_;
+        }
+        auto index = indices_.find(name);
+        return index == indices_.end() ? kNotFound : index->second;
+    }
+
+    // Like Find, but throws for unknown names.
+    [[nodiscard]] uint32_t Resolve(const std::string& name) const {
+        uint32_t index = Find(name);
+        if (index == kNotFound) {
+            throw std::runtime_error(Poco::format("Unknown dictionary \"%s\"", name));
+        }
+        return index;
+    }
+
+    [[nodiscard]] uint32_t DefaultIndex() const {
+        return default_index_;
+    }
+
+    [[nodiscard]] const std::string& Name(uint32_t index) const {
+        return names_[index];
+    }
+
+    [[nodiscard]] const std::shared_ptr<DictionaryHolder>& Holder(uint32_t index) const {
+        return holders_[index];
+    }
+
+    enum class ReloadStatus {
+        kReloaded,
+        kInProgress,
+        kFailed
+    };
+
+    struct ReloadOutcome {
+        ReloadStatus status;
+        // what the loader threw if the reload failed
+        std::string error;
+    };
+
+    // Reloads all dictionaries in parallel and returns what happened to each of them, in the order of indices.
+    // Dictionaries whose reload was already in progress are skipped, and the ones failing to load keep serving
+    // their current generation.
+    std::vector<ReloadOutcome> Reload() {
+        std::vector<std::future<bool>> reloads;
+        for (const auto& holder: holders_) {
+            reloads.push_back(std::async(std::launch::async, [&holder]() {
+                return holder->Reload();
+            }));
+        }
+        std::vector<ReloadOutcome> outcomes;
+        for (auto& reload: reloads) {
+            try {
+                outcomes.push_back({reload.get() ? ReloadStatus::kReloaded : ReloadStatus::kInProgress, ""});
+            } catch (std::exception& e) {
+                outcomes.push_back({ReloadStatus::kFailed, e.what()});
+            }
+        }
+        return outcomes;
+    }
+
+    static const char* StatusName(ReloadStatus status) {
+        switch (status) {
+            case ReloadStatus::kReloaded:
+                return "reloaded";
+            case ReloadStatus::kInProgress:
+                return "in_progress";
+            case ReloadStatus::kFailed:
+                return "failed";
+        }
+        return "unknown";
+    }
+
+private:
+    std::vector<std::string> names_;
+    std::unordered_map<std::string, uint32_t> indices_;
+    std::vector<std::shared_ptr<DictionaryHolder>> holders_;
+    uint32_t default_index_ = 0;
+};
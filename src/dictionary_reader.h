@@ -0,0 +1,126 @@
+#pragma once
+
+#include <algorithm>
+#include <fstream>
+#include <functional>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include <Poco/String.h>
+#include <Poco/Format.h>
+
+#include "utf8.h"
+
+
+using DictionaryEntries = std::vector<std::pair<std::wstring, uint32_t>>;
+
+
+namespace dictionary_reader {
+    using Shard = std::unordered_map<std::wstring, uint32_t>;
+
+    inline bool IsSpace(char ch) {
+        return ch == ' ' || ch == '\t' || ch == '\r' || ch == '\n' || ch == '\v' || ch == '\f';
+    }
+
+    // Parses "word priority" lines of [begin, end) and spreads words over shards by hash.
+    inline void ParseChunk(const char* begin, const char* end, std::vector<Shard>& shards) {
+        std::wstring word;
+        const char* line = begin;
+        while (line < end) {
+            const char* line_end = std::find(line, end, '\n');
+            const char* word_begin = std::find_if_not(line, line_end, IsSpace);
+            const char* word_end = std::find_if(word_begin, line_end, IsSpace);
+            const char* priority_begin = std::find_if_not(word_end, line_end, IsSpace);
+            const char* priority_end = std::find_if(priority_begin, line_end, IsSpace);
+            line = line_end + 1;
+            if (word_begin == word_end || priority_begin == priority_end) {
+                continue;
+            }
+            try {
+                auto priority = static_cast<uint32_t>(std::stoul(std::string(priority_begin, priority_end)));
+                if (!utf8::Decode(std::string_view(word_begin, static_cast<size_t>(word_end - word_begin)), word)) {
+                    continue;
+                }
+                Poco::toLowerInPlace(word);
+                auto& shard = shards[std::hash<std::wstring>()(word) % shards.size()];
+                shard[word] += priority;
+            } catch (std::exception&) {
+                continue;
+            }
+        }
+    }
+}
+
+
+// Reads dictionary file, every line of which consists of a word and its priority. The file is split into chunks
+// parsed on separate threads, words are lowercased and priorities of repeated words are summed up.
+DictionaryEntries ReadDictionary(const std::string& file_name, size_t threads_count) {
+    std::ifstream input_file(file_name, std::ios::binary);
+    if (!input_file) {
+        throw std::runtime_error(Poco::format("Dictionary file \"%s\" can't be opened", file_name));
+    }
+    input_file.seekg(0, std::ios::end);
+    std::string content(static_cast<size_t>(input_file.tellg()), '\0');
+    input_file.seekg(0, std::ios::beg);
+    input_file.read(content.data(), static_cast<std::streamsize>(content.size()));
+    input_file.close();
+
+    threads_count = std::max<size_t>(1, std::min(threads_count, content.size() / (1 << 16) + 1));
+    std::vector<std::vector<dictionary_reader::Shard>> partial(
+            threads_count, std::vector<dictionary_reader::Shard>(threads_count));
+    std::vector<std::thread> threads;
+    const char* chunk_begin = content.data();
+    const char* content_end = content.data() + content.size();
+    for (size_t index = 0; index < threads_count; ++index) {
+        const char* chunk_end = content_end;
+        if (index + 1 < threads_count) {
+            chunk_end = std::min(content_end, chunk_begin + content.size() / threads_count);
+            chunk_end = std::find(chunk_end, content_end, '\n');
+        }
+        threads.emplace_back(dictionary_reader::ParseChunk, chunk_begin, chunk_end, std::ref(partial[index]));
+        chunk_begin = chunk_end;
+    }
+    for (auto& thread: threads) {
+        thread.join();
+    }
+    threads.clear();
+
+    // shard i of every chunk holds the same subset of words, so shards are merged independently
+    std::vector<DictionaryEntries> merged(threads_count);
+    for (size_t shard = 0; shard < threads_count; ++shard) {
+        threads.emplace_back([&partial, &merged, shard]() {
+            auto& result = partial[0][shard];
+            for (size_t chunk = 1; chunk < partial.size(); ++chunk) {
+                auto& source = partial[chunk][shard];
+                while (!source.empty()) {
+                    auto inserted = result.insert(source.extract(source.begin()));
+                    if (!inserted.inserted) {
+                        inserted.position->second += inserted.node.mapped();
+                    }
+                }
+            }
+            merged[shard].reserve(result.size());
+            while (!result.empty()) {
+                auto node = result.extract(result.begin());
+                merged[shard].emplace_back(std::move(node.key()), node.mapped());
+            }
+        });
+    }
+    for (auto& thread: threads) {
+        thread.join();
+    }
+
+    DictionaryEntries words;
+    size_t words_count = 0;
+    for (const auto& shard: merged) {
+        words_count += shard.size();
+    }
+    words.reserve(words_count);
+    for (auto& shard: merged) {
+        std::move(shard.begin(), shard.end(), std::back_inserter(words));
+        DictionaryEntries().swap(shard);
+    }
+    return words;
+}
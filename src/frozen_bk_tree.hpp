@@ -0,0 +1,741 @@
+#pragma once
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <fstream>
+#include <limits>
+#include <memory>
+#include <stdexcept>
+#include <string_view>
+#include <type_traits>
+#include <vector>
+
+#include <Poco/Format.h>
+
+#include "metric.h"
+#include "mapped_file.h"
+
+
+struct SearchResult {
+    std::wstring result;
+    uint32_t tolerance;
+    uint32_t priority;
+};
+
+
+// Element of a batch search, limit of 0 means all results within the tolerance. The search stops early once it
+// has visited max_nodes_visited nodes or has run for deadline_ms milliseconds, 0 means no such bound.
+struct SearchQuery {
+    std::wstring word;
+    uint32_t tolerance;
+    size_t limit;
+    uint64_t deadline_ms = 0;
+    uint64_t max_nodes_visited = 0;
+};
+
+
+// Work done by a search: nodes entered, distances computed and subtrees skipped by the triangle inequality.
+struct SearchStats {
+    uint64_t nodes_visited = 0;
+    uint64_t metric_evaluations = 0;
+    uint64_t subtrees_pruned = 0;
+};
+
+
+// Results of a batch search for one query, the best found so far if its budget ran out.
+struct SearchOutcome {
+    std::vector<SearchResult> results;
+    bool is_truncated;
+    SearchStats stats;
+};
+
+
+// Collects results of a search ordered by distance, then by priority. With a limit only the best ones are kept
+// in a heap, and once it's full the tolerance shrinks to the distance of the worst of them, so traversals reading
+// Tolerance() prune subtrees that can't improve the result.
+// Traversals call Visit for every node they score and stop when it returns false.
+class SearchResultCollector {
+public:
+    SearchResultCollector(uint32_t tolerance, size_t limit, uint64_t deadline_ms = 0, uint64_t max_nodes_visited = 0)
+        : tolerance_(tolerance), limit_(limit), max_nodes_visited_(max_nodes_visited), has_deadline_(deadline_ms != 0) {
+        if (has_deadline_) {
+            deadline_ = std::chrono::steady_clock::now() + std::chrono::milliseconds(deadline_ms);
+        }
+    }
+
+    // Counts a visited node, returns false and marks the search truncated if the budget is already spent, so
+    // a search using up its budget exactly on the last node is complete. The clock is read every kClockPeriod nodes.
+    bool Visit() {
+        if (is_truncated_) {
+            return false;
+        }
+        if (stats_.nodes_visited == max_nodes_visited_ && max_nodes_visited_ != 0) {
+            is_truncated_ = true;
+            return false;
+        }
+        if (has_deadline_ && stats_.nodes_visited != 0 && stats_.nodes_visited % kClockPeriod == 0 &&
+                std::chrono::steady_clock::now() >= deadline_) {
+            is_truncated_ = true;
+            return false;
+        }
+        ++stats_.nodes_visited;
+        return true;
+    }
+
+    void CountEvaluations(uint64_t count) {
+        stats_.metric_evaluations += count;
+    }
+
+    void CountPruned(uint64_t count) {
+        stats_.subtrees_pruned += count;
+    }
+
+    [[nodiscard]] const SearchStats& Stats() const {
+        return stats_;
+    }
+
+    // Whether the budget ran out, so that the results may be incomplete.
+    [[nodiscard]] bool IsTruncated() const {
+        return is_truncated_;
+    }
+
+    [[nodiscard]] uint32_t Tolerance() const {
+        return tolerance_;
+    }
+
+    [[nodiscard]] bool IsLimited() const {
+        return limit_ != 0;
+    }
+
+    void Add(std::wstring_view word, uint32_t distance, uint32_t priority) {
+        if (distance > tolerance_) {
+            return;
+        }
+        if (!IsLimited()) {
+            results_.push_back(SearchResult({std::wstring(word), distance, priority}));
+            return;
+        }
+        if (results_.size() == limit_) {
+            const SearchResult& worst = results_.front();
+            if (distance == worst.tolerance && priority <= worst.priority) {
+                return;
+            }
+            std::pop_heap(results_.begin(), results_.end(), IsBetter);
+            results_.pop_back();
+        }
+        results_.push_back(SearchResult({std::wstring(word), distance, priority}));
+        std::push_heap(results_.begin(), results_.end(), IsBetter);
+        if (results_.size() == limit_) {
+            tolerance_ = results_.front().tolerance;
+        }
+    }
+
+    std::vector<SearchResult> Release() {
+        if (IsLimited()) {
+            std::sort_heap(results_.begin(), results_.end(), IsBetter);
+        } else {
+            std::sort(results_.begin(), results_.end(), IsBetter);
+        }
+        return std::move(results_);
+    }
+
+    static bool IsBetter(const SearchResult& _1, const SearchResult& _2) {
+        return _1.tolerance != _2.tolerance ? _1.tolerance < _2.tolerance : _1.priority > _2.priority;
+    }
+
+private:
+    static constexpr uint64_t kClockPeriod = 64;
+
+    uint32_t tolerance_;
+    size_t limit_;
+    // a heap with the worst result on top if the collector is limited
+    std::vector<SearchResult> results_;
+    SearchStats stats_;
+    uint64_t max_nodes_visited_;
+    bool has_deadline_;
+    std::chrono::steady_clock::time_point deadline_;
+    bool is_truncated_ = false;
+};
+
+
+// Summary of the words of a subtree: their lengths and which of 64 character classes occur in any and in all of
+// them. Together with the query summary it gives a lower bound of the distance to every word of the subtree.
+struct SubtreeSignature {
+    uint64_t any_classes;
+    uint64_t all_classes;
+    uint32_t min_length;
+    uint32_t max_length;
+
+    static uint64_t ClassBit(wchar_t key) {
+        // low bits keep the letters of one script apart
+        return uint64_t(1) << (static_cast<uint32_t>(key) & 63);
+    }
+};
+
+class QuerySignature {
+public:
+    QuerySignature() = default;
+
+    QuerySignature(std::wstring_view query, const AbstractWStringMetric& metric)
+            : length_(query.size()), insert_delete_cost_(metric.MinInsertDeleteCost()),
+              edit_cost_(metric.MinEditCost()) {
+        for (wchar_t ch: query) {
+            wchar_t key = metric.CharKey(ch);
+            classes_ |= SubtreeSignature::ClassBit(key);
+            ++counts_[static_cast<uint32_t>(key) & 63];
+        }
+    }
+
+    // Characters longer words have in excess must be deleted. Every query character of a class no word has
+    // must be deleted or replaced, and so does every word character of a class the query lacks, while one edit
+    // fixes at most one character on each side.
+    [[nodiscard]] uint64_t LowerBound(const SubtreeSignature& signature) const {
+        uint64_t length_difference = 0;
+        if (signature.min_length > length_) {
+            length_difference = signature.min_length - length_;
+        } else if (length_ > signature.max_length) {
+            length_difference = length_ - signature.max_length;
+        }
+        uint64_t query_misses = 0;
+        for (uint64_t missing = classes_ & ~signature.any_classes; missing != 0; missing &= missing - 1) {
+            query_misses += counts_[__builtin_ctzll(missing)];
+        }
+        uint64_t word_misses = __builtin_popcountll(signature.all_classes & ~classes_);
+        return std::max(length_difference * insert_delete_cost_, std::max(query_misses, word_misses) * edit_cost_);
+    }
+
+private:
+    uint64_t length_ = 0;
+    uint64_t insert_delete_cost_ = 0;
+    uint64_t edit_cost_ = 0;
+    uint64_t classes_ = 0;
+    uint32_t counts_[64] = {};
+};
+
+
+class TreeNode;
+
+// Immutable BK-tree laid out in flat arrays. Nodes are stored in BFS order, so children of every node
+// occupy a contiguous range sorted by distance to the parent, and all words share one character pool.
+// The arrays are either owned or point into a memory mapped index file written by Save.
+class FrozenBKTree {
+public:
+    struct Node {
+        uint32_t word_offset;
+        uint32_t word_length;
+        uint32_t priority;
+        uint32_t first_child;
+        uint32_t child_count;
+    };
+
+    FrozenBKTree() = default;
+    // Signatures of subtrees are computed with character keys of the metric.
+    FrozenBKTree(const TreeNode& root, const AbstractWStringMetric& metric);
+    FrozenBKTree(const FrozenBKTree&) = delete;
+    FrozenBKTree& operator=(const FrozenBKTree&) = delete;
+
+    // Writes the tree with identity of the metric it was built with into a binary index file.
+    void Save(const std::string& file_name, const std::string& metric_identity) const;
+    // Maps an index file into memory and serves queries right from it, the metric must match the saved one.
+    static std::unique_ptr<FrozenBKTree> Load(const std::string& file_name, const std::string& metric_identity);
+
+    // Walks the tree depth-first, or best-first if the number of results is limited, so that the best matches
+    // are found early and tighten the tolerance for the rest of the search.
+    void FindSimilar(std::wstring_view data, SearchResultCollector& results, const AbstractWStringMetric& metric,
+            MetricWorkspace& workspace) const {
+        if (nodes_count_ == 0) {
+            return;
+        }
+        QuerySignature signature(data, metric);
+        if (signature.LowerBound(signatures_[0]) > results.Tolerance()) {
+            results.CountPruned(1);
+            return;
+        }
+        metric.Prepare(data, workspace);
+        uint32_t distance = metric.QueryBounded(Word(0), get_cutoff(0, results.Tolerance()), workspace);
+        results.CountEvaluations(1);
+        if (results.IsLimited()) {
+            find_best_first(distance, signature, results, metric, workspace);
+        } else {
+            find_depth_first(distance, signature, results, metric, workspace);
+        }
+    }
+
+    static constexpr size_t kMaxBatchQueries = 64;
+
+    // Searches for up to kMaxBatchQueries queries in one walk. Every node is scored against all queries still
+    // interested in it at once, and the walk descends only into children some of them need.
+    void FindSimilarBatch(const std::wstring_view* queries, SearchResultCollector* results, size_t count,
+            const AbstractWStringMetric& metric, MetricWorkspace& workspace) const {
+        if (nodes_count_ == 0 || count == 0) {
+            return;
+        }
+        count = std::min(count, kMaxBatchQueries);
+        QuerySignature signatures[kMaxBatchQueries];
+        for (size_t index = 0; index < count; ++index) {
+            signatures[index] = QuerySignature(queries[index], metric);
+        }
+        uint64_t active = count == kMaxBatchQueries ? ~uint64_t(0) : (uint64_t(1) << count) - 1;
+        find_similar_batch(0, active, queries, signatures, results, metric, workspace);
+    }
+
+    static constexpr uint32_t kNotFound = std::numeric_limits<uint32_t>::max();
+
+    // Index of the node holding the word (at distance 0 from it), deleted nodes included, or kNotFound.
+    [[nodiscard]] uint32_t Find(std::wstring_view word, const AbstractWStringMetric& metric,
+            MetricWorkspace& workspace) const {
+        uint32_t node_index = 0;
+        while (node_index < nodes_count_) {
+            uint32_t distance = metric(word, Word(node_index), workspace);
+            if (distance == 0) {
+                return node_index;
+            }
+            const Node& node = nodes_[node_index];
+            const uint32_t* first = distances_ + node.first_child;
+            const uint32_t* last = first + node.child_count;
+            const uint32_t* child = std::lower_bound(first, last, distance);
+            if (child == last || *child != distance) {
+                return kNotFound;
+            }
+            node_index = static_cast<uint32_t>(child - distances_);
+        }
+        return kNotFound;
+    }
+
+    // Priorities and deletions changed after freezing are kept in an overlay, the layout itself never changes.
+    // Readers don't lock, but calls to Update must be serialized by the caller.
+    void Update(uint32_t node_index, uint32_t priority, bool is_deleted) {
+        if (overlay_storage_ == nullptr) {
+            overlay_storage_.reset(new std::atomic<uint64_t>[nodes_count_]());
+            overlay_.store(overlay_storage_.get(), std::memory_order_release);
+        }
+        overlay_storage_[node_index].store(kOverridden | (is_deleted ? kDeleted : 0) | priority,
+                std::memory_order_relaxed);
+    }
+
+    [[nodiscard]] uint32_t Priority(uint32_t node_index) const {
+        return get_priority(node_index, get_state(node_index));
+    }
+
+    [[nodiscard]] bool IsDeleted(uint32_t node_index) const {
+        return (get_state(node_index) & kDeleted) != 0;
+    }
+
+    [[nodiscard]] size_t Size() const {
+        return nodes_count_;
+    }
+
+    [[nodiscard]] std::wstring_view Word(uint32_t node_index) const {
+        const Node& node = nodes_[node_index];
+        return {words_ + node.word_offset, node.word_length};
+    }
+
+private:
+    // siblings are scored against the query in groups of this size, so the metric can batch them
+    static constexpr size_t kBatchSize = 8;
+    static constexpr size_t kCacheLineSize = 64;
+    // overlay state: priority in the low 32 bits and flags above
+    static constexpr uint64_t kOverridden = 1ull << 32;
+    static constexpr uint64_t kDeleted = 1ull << 33;
+
+    [[nodiscard]] uint64_t get_state(uint32_t node_index) const {
+        const std::atomic<uint64_t>* overlay = overlay_.load(std::memory_order_acquire);
+        return overlay == nullptr ? 0 : overlay[node_index].load(std::memory_order_relaxed);
+    }
+
+    // exact distance matters only while it can select a child or the node itself
+    [[nodiscard]] uint32_t get_cutoff(uint32_t node_index, uint32_t tolerance) const {
+        const Node& node = nodes_[node_index];
+        uint32_t max_dist = node.child_count == 0 ? 0 : distances_[node.first_child + node.child_count - 1];
+        return (max_dist > std::numeric_limits<uint32_t>::max() - tolerance) ?
+                std::numeric_limits<uint32_t>::max() : max_dist + tolerance;
+    }
+
+    [[nodiscard]] uint32_t get_priority(uint32_t node_index, uint64_t state) const {
+        return (state & kOverridden) ? static_cast<uint32_t>(state) : nodes_[node_index].priority;
+    }
+
+    // Adds the node to results if it's close enough and not deleted.
+    void collect(uint32_t node_index, uint32_t my_distance, SearchResultCollector& results) const {
+        if (my_distance <= results.Tolerance()) {
+            uint64_t state = get_state(node_index);
+            if (!(state & kDeleted)) {
+                results.Add(Word(node_index), my_distance, get_priority(node_index, state));
+            }
+        }
+    }
+
+    // Scores children of the node, whose distance to the parent may lead to results, in batches and passes
+    // each of them with its distance to visit.
+    template <class Visitor>
+    void score_children(uint32_t node_index, uint32_t my_distance, const QuerySignature& signature,
+            SearchResultCollector& results, const AbstractWStringMetric& metric, MetricWorkspace& workspace,
+            Visitor&& visit) const {
+        const Node& node = nodes_[node_index];
+        if (node.child_count == 0) {
+            return;
+        }
+        uint32_t tolerance = results.Tolerance();
+        uint32_t start = (my_distance < tolerance) ? 0 : my_distance - tolerance;
+        uint32_t end = (my_distance > std::numeric_limits<uint32_t>::max() - tolerance) ?
+                std::numeric_limits<uint32_t>::max() : my_distance + tolerance;
+
+        const uint32_t* first = distances_ + node.first_child;
+        const uint32_t* last = first + node.child_count;
+        const uint32_t* child = std::lower_bound(first, last, start);
+        uint32_t scored_count = 0;
+        while (child != last && *child <= end && !results.IsTruncated()) {
+            std::wstring_view words[kBatchSize];
+            uint32_t child_indices[kBatchSize], bounds[kBatchSize], child_distances[kBatchSize];
+            size_t count = 0;
+            for (; count < kBatchSize && child != last && *child <= end; ++child) {
+                auto child_index = static_cast<uint32_t>(child - distances_);
+                // the subtree has nothing within tolerance, so the child distance isn't needed either
+                if (signature.LowerBound(signatures_[child_index]) > tolerance) {
+                    continue;
+                }
+                child_indices[count] = child_index;
+                words[count] = Word(child_index);
+                bounds[count] = get_cutoff(child_index, tolerance);
+                ++count;
+            }
+            if (count == 0) {
+                continue;
+            }
+            metric.QueryBatch(words, bounds, count, child_distances, workspace);
+            scored_count += static_cast<uint32_t>(count);
+            for (size_t index = 0; index < count; ++index) {
+                visit(child_indices[index], child_distances[index]);
+            }
+        }
+        results.CountEvaluations(scored_count);
+        results.CountPruned(node.child_count - scored_count);
+    }
+
+    // Children ranges are laid out in order of their parents, so nodes, distances, signatures and words of the
+    // children of a node are each stored in one place, which is requested as soon as the node is scored and is
+    // read when it's expanded.
+    void prefetch_children(uint32_t node_index) const {
+        const Node& node = nodes_[node_index];
+        if (node.child_count != 0) {
+            __builtin_prefetch(nodes_ + node.first_child);
+            __builtin_prefetch(distances_ + node.first_child);
+            __builtin_prefetch(signatures_ + node.first_child);
+        }
+    }
+
+    // Words are only found through the nodes, so they are requested once the children nodes are in.
+    void prefetch_children_words(uint32_t node_index) const {
+        const Node& node = nodes_[node_index];
+        if (node.child_count != 0) {
+            const wchar_t* first_word = words_ + nodes_[node.first_child].word_offset;
+            __builtin_prefetch(first_word);
+            __builtin_prefetch(first_word + kCacheLineSize / sizeof(wchar_t));
+        }
+    }
+
+    // Walks the tree with an explicit stack: children of a node are scored together and pushed so that they are
+    // expanded in the order of the layout, like the recursive walk did, which keeps the walk cache friendly.
+    void find_depth_first(uint32_t root_distance, const QuerySignature& signature, SearchResultCollector& results,
+            const AbstractWStringMetric& metric, MetricWorkspace& workspace) const {
+        struct Entry {
+            uint32_t node_index;
+            uint32_t distance;
+        };
+        static thread_local std::vector<Entry> stack;
+        stack.clear();
+        stack.push_back({0, root_distance});
+        while (!stack.empty() && results.Visit()) {
+            Entry entry = stack.back();
+            stack.pop_back();
+            if (entry.distance > get_cutoff(entry.node_index, results.Tolerance())) {
+                results.CountPruned(1);
+                continue;
+            }
+            collect(entry.node_index, entry.distance, results);
+            prefetch_children_words(entry.node_index);
+            size_t first_pushed = stack.size();
+            score_children(entry.node_index, entry.distance, signature, results, metric, workspace,
+                    [&](uint32_t child_index, uint32_t child_distance) {
+                        prefetch_children(child_index);
+                        stack.push_back({child_index, child_distance});
+                    });
+            std::reverse(stack.begin() + first_pushed, stack.end());
+        }
+    }
+
+    // active has a bit set for every query which may find something in the subtree of the node
+    void find_similar_batch(uint32_t node_index, uint64_t active, const std::wstring_view* queries,
+            const QuerySignature* signatures, SearchResultCollector* results, const AbstractWStringMetric& metric,
+            MetricWorkspace& workspace) const {
+        std::wstring_view words[kMaxBatchQueries];
+        uint32_t query_indices[kMaxBatchQueries], bounds[kMaxBatchQueries], distances[kMaxBatchQueries];
+        size_t count = 0;
+        for (uint64_t rest = active; rest != 0; rest &= rest - 1) {
+            auto query = static_cast<uint32_t>(__builtin_ctzll(rest));
+            if (!results[query].Visit()) {
+                continue;
+            }
+            if (signatures[query].LowerBound(signatures_[node_index]) > results[query].Tolerance()) {
+                results[query].CountPruned(1);
+                continue;
+            }
+            query_indices[count] = query;
+            words[count] = queries[query];
+            bounds[count] = get_cutoff(node_index, results[query].Tolerance());
+            ++count;
+        }
+        if (count == 0) {
+            return;
+        }
+        metric.BoundedBatch(Word(node_index), words, bounds, count, distances, workspace);
+        for (size_t index = 0; index < count; ++index) {
+            results[query_indices[index]].CountEvaluations(1);
+        }
+
+        // ranges of child distances to the node each query needs
+        uint32_t starts[kMaxBatchQueries], ends[kMaxBatchQueries];
+        uint32_t min_start = std::numeric_limits<uint32_t>::max(), max_end = 0;
+        size_t live_count = 0;
+        for (size_t index = 0; index < count; ++index) {
+            if (distances[index] > bounds[index]) {
+                results[query_indices[index]].CountPruned(1);
+                continue;
+            }
+            SearchResultCollector& query_results = results[query_indices[index]];
+            collect(node_index, distances[index], query_results);
+            uint32_t tolerance = query_results.Tolerance();
+            query_indices[live_count] = query_indices[index];
+            starts[live_count] = (distances[index] < tolerance) ? 0 : distances[index] - tolerance;
+            ends[live_count] = (distances[index] > std::numeric_limits<uint32_t>::max() - tolerance) ?
+                    std::numeric_limits<uint32_t>::max() : distances[index] + tolerance;
+            min_start = std::min(min_start, starts[live_count]);
+            max_end = std::max(max_end, ends[live_count]);
+            ++live_count;
+        }
+        const Node& node = nodes_[node_index];
+        if (live_count == 0 || node.child_count == 0) {
+            return;
+        }
+
+        const uint32_t* first = distances_ + node.first_child;
+        const uint32_t* last = first + node.child_count;
+        uint32_t descended[kMaxBatchQueries] = {};
+        for (const uint32_t* child = std::lower_bound(first, last, min_start); child != last && *child <= max_end;
+                ++child) {
+            uint64_t child_active = 0;
+            for (size_t index = 0; index < live_count; ++index) {
+                if (starts[index] <= *child && *child <= ends[index]) {
+                    child_active |= uint64_t(1) << query_indices[index];
+                    ++descended[index];
+                }
+            }
+            if (child_active != 0) {
+                find_similar_batch(static_cast<uint32_t>(child - distances_), child_active, queries, signatures,
+                        results, metric, workspace);
+            }
+        }
+        for (size_t index = 0; index < live_count; ++index) {
+            results[query_indices[index]].CountPruned(node.child_count - descended[index]);
+        }
+    }
+
+    // Every node of a subtree is at the same distance from the subtree parent, so by the triangle inequality
+    // |d(query, parent) - d(node, parent)| bounds distance from the query to all of them. Subtrees are expanded
+    // in order of this bound until it exceeds the tolerance.
+    void find_best_first(uint32_t root_distance, const QuerySignature& signature, SearchResultCollector& results,
+            const AbstractWStringMetric& metric, MetricWorkspace& workspace) const {
+        struct Candidate {
+            uint32_t lower_bound;
+            uint32_t node_index;
+            uint32_t distance;
+        };
+        auto is_worse = [](const Candidate& _1, const Candidate& _2) {
+            return _1.lower_bound > _2.lower_bound;
+        };
+        std::vector<Candidate> queue;
+        auto visit = [&](uint32_t node_index, uint32_t distance, uint32_t lower_bound) {
+            if (!results.Visit()) {
+                return;
+            }
+            if (distance > get_cutoff(node_index, results.Tolerance())) {
+                results.CountPruned(1);
+                return;
+            }
+            collect(node_index, distance, results);
+            if (nodes_[node_index].child_count != 0) {
+                prefetch_children(node_index);
+                queue.push_back({lower_bound, node_index, distance});
+                std::push_heap(queue.begin(), queue.end(), is_worse);
+            }
+        };
+        visit(0, root_distance, 0);
+        while (!queue.empty() && !results.IsTruncated()) {
+            std::pop_heap(queue.begin(), queue.end(), is_worse);
+            Candidate candidate = queue.back();
+            queue.pop_back();
+            if (candidate.lower_bound > results.Tolerance()) {
+                results.CountPruned(queue.size() + 1);
+                break;
+            }
+            prefetch_children_words(candidate.node_index);
+            score_children(candidate.node_index, candidate.distance, signature, results, metric, workspace,
+                    [&](uint32_t child_index, uint32_t child_distance) {
+                        uint32_t edge = distances_[child_index];
+                        uint32_t bound = std::max(candidate.distance, edge) - std::min(candidate.distance, edge);
+                        visit(child_index, child_distance, std::max(candidate.lower_bound, bound));
+                    });
+        }
+    }
+
+    void attach_storage() {
+        nodes_ = node_storage_.data();
+        distances_ = distance_storage_.data();
+        signatures_ = signature_storage_.data();
+        words_ = word_storage_.data();
+        nodes_count_ = node_storage_.size();
+        words_size_ = word_storage_.size();
+    }
+
+    const Node* nodes_ = nullptr;
+    // distance from node to its parent; within every children range the values are strictly increasing
+    const uint32_t* distances_ = nullptr;
+    // signature of the subtree of every node, the node itself included
+    const SubtreeSignature* signatures_ = nullptr;
+    const wchar_t* words_ = nullptr;
+    size_t nodes_count_ = 0;
+    size_t words_size_ = 0;
+
+    std::vector<Node> node_storage_;
+    std::vector<uint32_t> distance_storage_;
+    std::vector<SubtreeSignature> signature_storage_;
+    std::vector<wchar_t> word_storage_;
+    std::unique_ptr<const MappedFile> mapped_file_;
+
+    std::unique_ptr<std::atomic<uint64_t>[]> overlay_storage_;
+    std::atomic<const std::atomic<uint64_t>*> overlay_{nullptr};
+};
+
+
+namespace index_file {
+    constexpr char kMagic[8] = {'B', 'K', 'T', 'R', 'E', 'E', 'I', 'X'};
+    constexpr uint32_t kVersion = 2;
+    constexpr uint32_t kByteOrderMark = 0x01020304;
+
+    // Sections follow the header in the order nodes, distances, signatures, words, metric identity, each padded
+    // to 8 bytes.
+    // The checksum covers everything after the header.
+    struct Header {
+        char magic[8];
+        uint32_t version;
+        uint32_t byte_order_mark;
+        uint32_t node_size;
+        uint32_t char_size;
+        uint64_t nodes_count;
+        uint64_t words_size;
+        uint64_t metric_identity_size;
+        uint64_t payload_size;
+        uint64_t checksum;
+    };
+    static_assert(std::is_trivially_copyable_v<Header> && sizeof(Header) % 8 == 0);
+    static_assert(std::is_trivially_copyable_v<FrozenBKTree::Node>);
+    static_assert(std::is_trivially_copyable_v<SubtreeSignature> && sizeof(SubtreeSignature) == 24);
+
+    inline uint64_t PaddedSize(uint64_t size) {
+        return (size + 7) / 8 * 8;
+    }
+}
+
+void FrozenBKTree::Save(const std::string& file_name, const std::string& metric_identity) const {
+    std::ofstream output(file_name, std::ios::binary | std::ios::trunc);
+    if (!output) {
+        throw std::runtime_error(Poco::format("Index file \"%s\" can't be created", file_name));
+    }
+    index_file::Header header{};
+    std::copy(std::begin(index_file::kMagic), std::end(index_file::kMagic), header.magic);
+    header.version = index_file::kVersion;
+    header.byte_order_mark = index_file::kByteOrderMark;
+    header.node_size = sizeof(Node);
+    header.char_size = sizeof(wchar_t);
+    header.nodes_count = nodes_count_;
+    header.words_size = words_size_;
+    header.metric_identity_size = metric_identity.size();
+    header.checksum = Checksum(nullptr, 0);
+    output.write(reinterpret_cast<const char*>(&header), sizeof(header));
+
+    auto write_section = [&output, &header](const void* data, uint64_t size) {
+        if (size == 0) {
+            return;
+        }
+        // checksum consumes whole 64-bit words, so the unaligned tail is hashed together with the padding
+        uint64_t aligned_size = size / 8 * 8;
+        char tail[8] = {};
+        std::memcpy(tail, static_cast<const char*>(data) + aligned_size, size - aligned_size);
+        output.write(static_cast<const char*>(data), static_cast<std::streamsize>(aligned_size));
+        header.checksum = Checksum(static_cast<const char*>(data), aligned_size, header.checksum);
+        if (aligned_size != size) {
+            output.write(tail, sizeof(tail));
+            header.checksum = Checksum(tail, sizeof(tail), header.checksum);
+        }
+        header.payload_size += index_file::PaddedSize(size);
+    };
+    write_section(nodes_, nodes_count_ * sizeof(Node));
+    write_section(distances_, nodes_count_ * sizeof(uint32_t));
+    write_section(signatures_, nodes_count_ * sizeof(SubtreeSignature));
+    write_section(words_, words_size_ * sizeof(wchar_t));
+    write_section(metric_identity.data(), metric_identity.size());
+
+    output.seekp(0);
+    output.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    output.close();
+    if (!output) {
+        throw std::runtime_error(Poco::format("Can't write index file \"%s\"", file_name));
+    }
+}
+
+std::unique_ptr<FrozenBKTree> FrozenBKTree::Load(const std::string& file_name, const std::string& metric_identity) {
+    auto mapped_file = std::make_unique<const MappedFile>(file_name);
+    index_file::Header header{};
+    if (mapped_file->Size() < sizeof(header)) {
+        throw std::runtime_error(Poco::format("Index file \"%s\" is truncated", file_name));
+    }
+    std::memcpy(&header, mapped_file->Data(), sizeof(header));
+    if (!std::equal(std::begin(index_file::kMagic), std::end(index_file::kMagic), header.magic)) {
+        throw std::runtime_error(Poco::format("File \"%s\" is not a bk_tree index", file_name));
+    }
+    if (header.version != index_file::kVersion || header.byte_order_mark != index_file::kByteOrderMark ||
+            header.node_size != sizeof(Node) || header.char_size != sizeof(wchar_t)) {
+        throw std::runtime_error(Poco::format(
+                "Index file \"%s\" has version %u or was built on another platform, expected version %u",
+                file_name, header.version, index_file::kVersion));
+    }
+
+    uint64_t nodes_offset = sizeof(header);
+    uint64_t distances_offset = nodes_offset + index_file::PaddedSize(header.nodes_count * sizeof(Node));
+    uint64_t signatures_offset = distances_offset + index_file::PaddedSize(header.nodes_count * sizeof(uint32_t));
+    uint64_t words_offset = signatures_offset
+            + index_file::PaddedSize(header.nodes_count * sizeof(SubtreeSignature));
+    uint64_t metric_offset = words_offset + index_file::PaddedSize(header.words_size * sizeof(wchar_t));
+    uint64_t end_offset = metric_offset + index_file::PaddedSize(header.metric_identity_size);
+    if (end_offset != sizeof(header) + header.payload_size || end_offset != mapped_file->Size()) {
+        throw std::runtime_error(Poco::format("Index file \"%s\" is truncated", file_name));
+    }
+    if (Checksum(mapped_file->Data() + sizeof(header), header.payload_size) != header.checksum) {
+        throw std::runtime_error(Poco::format("Index file \"%s\" is corrupted: checksum mismatch", file_name));
+    }
+    std::string saved_identity(mapped_file->Data() + metric_offset, header.metric_identity_size);
+    if (saved_identity != metric_identity) {
+        throw std::runtime_error(Poco::format("Index file \"%s\" was built with metric \"%s\", but \"%s\" is used",
+                file_name, saved_identity, metric_identity));
+    }
+
+    auto tree = std::make_unique<FrozenBKTree>();
+    tree->nodes_ = reinterpret_cast<const Node*>(mapped_file->Data() + nodes_offset);
+    tree->distances_ = reinterpret_cast<const uint32_t*>(mapped_file->Data() + distances_offset);
+    tree->signatures_ = reinterpret_cast<const SubtreeSignature*>(mapped_file->Data() + signatures_offset);
+    tree->words_ = reinterpret_cast<const wchar_t*>(mapped_file->Data() + words_offset);
+    tree->nodes_count_ = header.nodes_count;
+    tree->words_size_ = header.words_size;
+    tree->mapped_file_ = std::move(mapped_file);
+    return tree;
+}
@@ -0,0 +1,330 @@
+#pragma once
+
+#include <cstdint>
+#include <istream>
+#include <limits>
+#include <ostream>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include <Poco/Format.h>
+
+
+// Pull parser reading JSON values one at a time right from the stream, so that large arrays are processed
+// without building a document. Strings are returned as UTF-8.
+class JsonStreamReader {
+public:
+    explicit JsonStreamReader(std::istream& input) : input_(*input.rdbuf()) {
+    }
+
+    void BeginArray() {
+        expect('[');
+        is_first_.push_back(true);
+    }
+
+    // Moves to the next element of the current array, returns false and leaves the array at its end.
+    bool NextElement() {
+        return next(']');
+    }
+
+    void BeginObject() {
+        expect('{');
+        is_first_.push_back(true);
+    }
+
+    // Reads the key of the next member of the current object, returns false and leaves the object at its end.
+    bool NextKey(std::string& key) {
+        if (!next('}')) {
+            return false;
+        }
+        key = ReadString();
+        expect(':');
+        return true;
+    }
+
+    std::string ReadString() {
+        expect('"');
+        std::string value;
+        while (true) {
+            int ch = get();
+            if (ch == '"') {
+                return value;
+            }
+            if (ch == '\\') {
+                read_escape(value);
+            } else if (ch < 0x20) {
+                throw error("unterminated string");
+            } else {
+                value.push_back(static_cast<char>(ch));
+            }
+        }
+    }
+
+    uint64_t ReadUnsigned() {
+        skip_spaces();
+        if (!is_digit(peek())) {
+            throw error("unsigned integer expected");
+        }
+        uint64_t value = 0;
+        while (is_digit(peek())) {
+            uint64_t digit = static_cast<uint64_t>(get() - '0');
+            if (value > (std::numeric_limits<uint64_t>::max() - digit) / 10) {
+                throw error("integer is too large");
+            }
+            value = value * 10 + digit;
+        }
+        return value;
+    }
+
+    // Skips any value without recursion, so a deeply nested one under an unknown key can't exhaust the stack.
+    void SkipValue() {
+        // closing brackets of the arrays and objects being skipped
+        std::vector<char> closing;
+        std::string key;
+        do {
+            if (!closing.empty()) {
+                bool has_value = closing.back() == ']' ? NextElement() : NextKey(key);
+                if (!has_value) {
+                    closing.pop_back();
+                    continue;
+                }
+            }
+            skip_spaces();
+            int ch = peek();
+            if (ch == '"') {
+                ReadString();
+            } else if (ch == '[') {
+                BeginArray();
+                closing.push_back(']');
+            } else if (ch == '{') {
+                BeginObject();
+                closing.push_back('}');
+            } else {
+                // number or literal
+                while (ch != kEnd && ch != ',' && ch != ']' && ch != '}' && !is_space(ch)) {
+                    get();
+                    ch = peek();
+                }
+            }
+        } while (!closing.empty());
+    }
+
+private:
+    static constexpr int kEnd = std::char_traits<char>::eof();
+
+    static bool is_space(int ch) {
+        return ch == ' ' || ch == '\t' || ch == '\n' || ch == '\r';
+    }
+
+    static bool is_digit(int ch) {
+        return ch >= '0' && ch <= '9';
+    }
+
+    int peek() {
+        return input_.sgetc();
+    }
+
+    int get() {
+        int ch = input_.sbumpc();
+        if (ch == kEnd) {
+            throw error("unexpected end of input");
+        }
+        ++position_;
+        return ch;
+    }
+
+    void skip_spaces() {
+        while (is_space(peek())) {
+            get();
+        }
+    }
+
+    void expect(char expected) {
+        skip_spaces();
+        if (peek() != static_cast<unsigned char>(expected)) {
+            throw error(std::string("'") + expected + "' expected");
+        }
+        get();
+    }
+
+    // Consumes a separator or the closing bracket of the current array or object.
+    bool next(char closing) {
+        skip_spaces();
+        if (is_first_.empty()) {
+            throw error("no array or object to read from");
+        }
+        if (peek() == static_cast<unsigned char>(closing)) {
+            get();
+            is_first_.pop_back();
+            return false;
+        }
+        if (!is_first_.back()) {
+            expect(',');
+        }
+        is_first_.back() = false;
+        return true;
+    }
+
+    uint32_t read_hex() {
+        uint32_t value = 0;
+        for (int index = 0; index < 4; ++index) {
+            int ch = get();
+            value <<= 4;
+            if (is_digit(ch)) {
+                value |= static_cast<uint32_t>(ch - '0');
+            } else if (ch >= 'a' && ch <= 'f') {
+                value |= static_cast<uint32_t>(ch - 'a' + 10);
+            } else if (ch >= 'A' && ch <= 'F') {
+                value |= static_cast<uint32_t>(ch - 'A' + 10);
+            } else {
+                throw error("invalid \\u escape");
+            }
+        }
+        return value;
+    }
+
+    void read_escape(std::string& value) {
+        int ch = get();
+        switch (ch) {
+            case '"': value.push_back('"'); return;
+            case '\\': value.push_back('\\'); return;
+            case '/': value.push_back('/'); return;
+            case 'b': value.push_back('\b'); return;
+            case 'f': value.push_back('\f'); return;
+            case 'n': value.push_back('\n'); return;
+            case 'r': value.push_back('\r'); return;
+            case 't': value.push_back('\t'); return;
+            case 'u': break;
+            default: throw error("invalid escape");
+        }
+        uint32_t code_point = read_hex();
+        if (code_point >= 0xD800 && code_point < 0xDC00) {
+            if (get() != '\\' || get() != 'u') {
+                throw error("unpaired surrogate");
+            }
+            uint32_t low = read_hex();
+            if (low < 0xDC00 || low >= 0xE000) {
+                throw error("unpaired surrogate");
+            }
+            code_point = 0x10000 + ((code_point - 0xD800) << 10) + (low - 0xDC00);
+        }
+        if (code_point < 0x80) {
+            value.push_back(static_cast<char>(code_point));
+        } else if (code_point < 0x800) {
+            value.push_back(static_cast<char>(0xC0 | (code_point >> 6)));
+            value.push_back(static_cast<char>(0x80 | (code_point & 0x3F)));
+        } else if (code_point < 0x10000) {
+            value.push_back(static_cast<char>(0xE0 | (code_point >> 12)));
+            value.push_back(static_cast<char>(0x80 | ((code_point >> 6) & 0x3F)));
+            value.push_back(static_cast<char>(0x80 | (code_point & 0x3F)));
+        } else {
+            value.push_back(static_cast<char>(0xF0 | (code_point >> 18)));
+            value.push_back(static_cast<char>(0x80 | ((code_point >> 12) & 0x3F)));
+            value.push_back(static_cast<char>(0x80 | ((code_point >> 6) & 0x3F)));
+            value.push_back(static_cast<char>(0x80 | (code_point & 0x3F)));
+        }
+    }
+
+    std::runtime_error error(const std::string& message) const {
+        return std::runtime_error(Poco::format("Invalid JSON at byte %z: %s", position_, message));
+    }
+
+    std::streambuf& input_;
+    size_t position_ = 0;
+    // for every open array or object whether no element has been read from it yet
+    std::vector<bool> is_first_;
+};
+
+
+// Writes compact JSON right into the stream, inserting separators between elements.
+class JsonStreamWriter {
+public:
+    explicit JsonStreamWriter(std::ostream& output) : output_(output) {
+    }
+
+    void BeginArray() {
+        separate();
+        output_.put('[');
+        is_first_.push_back(true);
+    }
+
+    void EndArray() {
+        output_.put(']');
+        is_first_.pop_back();
+    }
+
+    void BeginObject() {
+        separate();
+        output_.put('{');
+        is_first_.push_back(true);
+    }
+
+    void EndObject() {
+        output_.put('}');
+        is_first_.pop_back();
+    }
+
+    void Key(std::string_view key) {
+        String(key);
+        output_.put(':');
+        is_after_key_ = true;
+    }
+
+    void String(std::string_view value) {
+        separate();
+        output_.put('"');
+        size_t plain_begin = 0;
+        for (size_t index = 0; index < value.size(); ++index) {
+            auto ch = static_cast<unsigned char>(value[index]);
+            if (ch >= 0x20 && ch != '"' && ch != '\\') {
+                continue;
+            }
+            output_.write(value.data() + plain_begin, static_cast<std::streamsize>(index - plain_begin));
+            plain_begin = index + 1;
+            switch (ch) {
+                case '"': output_ << "\\\""; break;
+                case '\\': output_ << "\\\\"; break;
+                case '\n': output_ << "\\n"; break;
+                case '\r': output_ << "\\r"; break;
+                case '\t': output_ << "\\t"; break;
+                default: {
+                    const char* digits = "0123456789abcdef";
+                    const char escaped[] = {'\\', 'u', '0', '0', digits[ch >> 4], digits[ch & 0xF]};
+                    output_.write(escaped, sizeof(escaped));
+                }
+            }
+        }
+        output_.write(value.data() + plain_begin, static_cast<std::streamsize>(value.size() - plain_begin));
+        output_.put('"');
+    }
+
+    void Number(uint64_t value) {
+        separate();
+        output_ << value;
+    }
+
+    void Bool(bool value) {
+        separate();
+        output_ << (value ? "true" : "false");
+    }
+
+private:
+    void separate() {
+        if (is_after_key_) {
+            is_after_key_ = false;
+            return;
+        }
+        if (!is_first_.empty()) {
+            if (!is_first_.back()) {
+                output_.put(',');
+            }
+            is_first_.back() = false;
+        }
+    }
+
+    std::ostream& output_;
+    std::vector<bool> is_first_;
+    bool is_after_key_ = false;
+};
@@ -0,0 +1,77 @@
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <Poco/Format.h>
+
+
+// Read-only shared memory mapping of a whole file. Pages are shared with every other process mapping it.
+class MappedFile {
+public:
+    explicit MappedFile(const std::string& file_name) {
+        int descriptor = open(file_name.c_str(), O_RDONLY);
+        if (descriptor < 0) {
+            throw std::runtime_error(Poco::format("File \"%s\" can't be opened", file_name));
+        }
+        struct stat file_stat{};
+        if (fstat(descriptor, &file_stat) != 0) {
+            close(descriptor);
+            throw std::runtime_error(Poco::format("Can't get size of file \"%s\"", file_name));
+        }
+        size_ = static_cast<size_t>(file_stat.st_size);
+        if (size_ > 0) {
+            void* data = mmap(nullptr, size_, PROT_READ, MAP_SHARED, descriptor, 0);
+            if (data == MAP_FAILED) {
+                close(descriptor);
+                throw std::runtime_error(Poco::format("File \"%s\" can't be mapped into memory", file_name));
+            }
+            data_ = static_cast<const char*>(data);
+        }
+        close(descriptor);
+    }
+
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    ~MappedFile() {
+        if (data_ != nullptr) {
+            munmap(const_cast<char*>(data_), size_);
+        }
+    }
+
+    [[nodiscard]] const char* Data() const {
+        return data_;
+    }
+
+    [[nodiscard]] size_t Size() const {
+        return size_;
+    }
+
+private:
+    const char* data_ = nullptr;
+    size_t size_ = 0;
+};
+
+
+// FNV-1a over 64-bit words, continuing from hash. Much faster than the bytewise variant on large files.
+inline uint64_t Checksum(const char* data, size_t size, uint64_t hash = 14695981039346656037ull) {
+    const uint64_t prime = 1099511628211ull;
+    size_t index = 0;
+    for (; index + sizeof(uint64_t) <= size; index += sizeof(uint64_t)) {
+        uint64_t word;
+        std::memcpy(&word, data + index, sizeof(word));
+        hash = (hash ^ word) * prime;
+    }
+    for (; index < size; ++index) {
+        hash = (hash ^ static_cast<unsigned char>(data[index])) * prime;
+    }
+    return hash;
+}
@@ -5,10 +5,11 @@
 #include <iostream>
 #include <vector>
 #include <string>
+#include <string_view>
 #include <unordered_map>
-#include <codecvt>
-#include <locale>
+#include <limits>
 #include <sstream>
+#include <cwctype>
 
 #include <Poco/Format.h>
 #include <Poco/SharedPtr.h>
@@ -18,52 +19,124 @@
 #include <Poco/JSON/Parser.h>
 #include <Poco/StreamCopier.h>
 
-#include "caches.h"
+#include "bit_parallel.h"
+#include "utf8.h"
 
 using namespace Poco::JSON;
 
-uint32_t Dist(const std::wstring& left_input, const std::wstring& right_input) {
+// String translated by WeightedLevensteinMetric: case folded characters, their classes and insertion costs.
+struct MappedString {
+    std::vector<wchar_t> chars;
+    std::vector<uint16_t> classes;
+    std::vector<uint32_t> insert_delete_costs;
+};
+
+// Scratch space for metric evaluation. Metrics are stateless, so every thread (or query) passes its own
+// workspace, and buffers are reused between calls instead of being allocated for each distance.
+struct MetricWorkspace {
     std::vector<uint32_t> buffer_src, buffer_dst;
-    const std::wstring& left = left_input.size() < right_input.size() ? left_input : right_input;
-    const std::wstring& right = left_input.size() >= right_input.size() ? left_input : right_input;
+    PatternMasks pair_masks;
+    MappedString left_mapped, right_mapped;
+
+    // query state filled by AbstractWStringMetric::Prepare
+    std::wstring_view query;
+    PatternMasks query_masks;
+    bool is_query_masked = false;
+    MappedString query_mapped;
+};
 
-    if (buffer_src.size() < left.size() + 1) {
-        buffer_src.resize(left.size() + 1);
-        buffer_dst.resize(left.size() + 1);
+class AbstractWStringMetric {
+public:
+    virtual ~AbstractWStringMetric() = default;
+    virtual uint32_t operator()(std::wstring_view left, std::wstring_view right,
+            MetricWorkspace& workspace) const = 0;
+
+    // Name and parameters of the metric, trees built with metrics of different identities are incompatible.
+    [[nodiscard]] virtual std::string Identity() const = 0;
+
+    // Returns the distance if it doesn't exceed bound and any value greater than bound otherwise.
+    virtual uint32_t Bounded(std::wstring_view left, std::wstring_view right, uint32_t bound,
+            MetricWorkspace& workspace) const {
+        return std::min((*this)(left, right, workspace), SaturatedBound(bound));
     }
 
-    for (uint32_t i = 0; i < buffer_src.size(); ++i) {
-        buffer_src[i] = i;
+    // Remembers the query (which must outlive the search) and does per-query precomputations,
+    // after which QueryBounded and QueryBatch compare dictionary words against it.
+    virtual void Prepare(std::wstring_view query, MetricWorkspace& workspace) const {
+        workspace.query = query;
     }
 
-    for (size_t i = 1; i < right.size() + 1; ++i) {
-        for (size_t j = 0; j < left.size() + 1; ++j) {
-            if (j == 0) {
-                buffer_dst[j] = i;
-            } else {
-                uint32_t substitution_const = (left[j - 1] == right[i - 1]) ? 0 : 1;
-                buffer_dst[j] = std::min(buffer_dst[j - 1] + 1, buffer_src[j] + 1);
-                buffer_dst[j] = std::min(buffer_dst[j], substitution_const + buffer_src[j - 1]);
-            }
+    virtual uint32_t QueryBounded(std::wstring_view word, uint32_t bound, MetricWorkspace& workspace) const {
+        return Bounded(workspace.query, word, bound, workspace);
+    }
+
+    virtual void QueryBatch(const std::wstring_view* words, const uint32_t* bounds, size_t count,
+            uint32_t* distances, MetricWorkspace& workspace) const {
+        for (size_t index = 0; index < count; ++index) {
+            distances[index] = QueryBounded(words[index], bounds[index], workspace);
         }
-        buffer_dst.swap(buffer_src);
     }
-    return buffer_src.back();
-}
 
-class AbstractWStringMetric {
-public:
-    virtual uint32_t operator()(const std::wstring& left, const std::wstring& right) = 0;
+    // Lower bounds of edit costs used by the tree prefilters: inserting or deleting a character costs at least
+    // MinInsertDeleteCost and any edit at least MinEditCost. Zero, the default, disables the bound.
+    [[nodiscard]] virtual uint32_t MinInsertDeleteCost() const {
+        return 0;
+    }
+
+    [[nodiscard]] virtual uint32_t MinEditCost() const {
+        return 0;
+    }
+
+    // Character as the metric compares it, characters with different keys are never matched for free.
+    [[nodiscard]] virtual wchar_t CharKey(wchar_t ch) const {
+        return ch;
+    }
+
+    // Bounded distances from the word to each of others, used to score a dictionary word against many queries.
+    virtual void BoundedBatch(std::wstring_view word, const std::wstring_view* others, const uint32_t* bounds,
+            size_t count, uint32_t* distances, MetricWorkspace& workspace) const {
+        for (size_t index = 0; index < count; ++index) {
+            distances[index] = Bounded(word, others[index], bounds[index], workspace);
+        }
+    }
+
+protected:
+    static uint32_t SaturatedBound(uint32_t bound) {
+        return bound == std::numeric_limits<uint32_t>::max() ? bound : bound + 1;
+    }
 };
 
 
 class LevensteinMetric : public AbstractWStringMetric {
 public:
     LevensteinMetric() = default;
-    uint32_t operator()(const std::wstring& left_input, const std::wstring& right_input) override;
+    uint32_t operator()(std::wstring_view left_input, std::wstring_view right_input,
+            MetricWorkspace& workspace) const override;
+    uint32_t Bounded(std::wstring_view left_input, std::wstring_view right_input, uint32_t bound,
+            MetricWorkspace& workspace) const override;
+
+    [[nodiscard]] std::string Identity() const override {
+        return "levenstein";
+    }
+
+    [[nodiscard]] uint32_t MinInsertDeleteCost() const override {
+        return 1;
+    }
+
+    [[nodiscard]] uint32_t MinEditCost() const override {
+        return 1;
+    }
+
+    void Prepare(std::wstring_view query, MetricWorkspace& workspace) const override;
+    uint32_t QueryBounded(std::wstring_view word, uint32_t bound, MetricWorkspace& workspace) const override;
+    void QueryBatch(const std::wstring_view* words, const uint32_t* bounds, size_t count,
+            uint32_t* distances, MetricWorkspace& workspace) const override;
+    void BoundedBatch(std::wstring_view word, const std::wstring_view* others, const uint32_t* bounds,
+            size_t count, uint32_t* distances, MetricWorkspace& workspace) const override;
 
 private:
-    std::vector<uint32_t> buffer_src, buffer_dst;
+    uint32_t banded_distance(std::wstring_view left, std::wstring_view right, uint32_t bound,
+            MetricWorkspace& workspace) const;
 };
 
 
@@ -92,27 +165,66 @@ class WeightedLevensteinMetric : public AbstractWStringMetric {
 public:
     WeightedLevensteinMetric();
     explicit WeightedLevensteinMetric(const std::string& config_file_name);
-    uint32_t operator()(const std::wstring& left_input, const std::wstring& right_input) override;
+    uint32_t operator()(std::wstring_view left_input, std::wstring_view right_input,
+            MetricWorkspace& workspace) const override;
+    uint32_t Bounded(std::wstring_view left_input, std::wstring_view right_input, uint32_t bound,
+            MetricWorkspace& workspace) const override;
+
+    [[nodiscard]] std::string Identity() const override;
+
+    [[nodiscard]] uint32_t MinInsertDeleteCost() const override {
+        return min_insert_delete_;
+    }
+
+    [[nodiscard]] uint32_t MinEditCost() const override {
+        return std::min(min_insert_delete_, min_replace_);
+    }
+
+    [[nodiscard]] wchar_t CharKey(wchar_t ch) const override {
+        return is_case_sensitive_ ? ch : static_cast<wchar_t>(towlower(ch));
+    }
+
+    void Prepare(std::wstring_view query, MetricWorkspace& workspace) const override;
+    uint32_t QueryBounded(std::wstring_view word, uint32_t bound, MetricWorkspace& workspace) const override;
+    void BoundedBatch(std::wstring_view word, const std::wstring_view* others, const uint32_t* bounds,
+            size_t count, uint32_t* distances, MetricWorkspace& workspace) const override;
 
 private:
-    uint32_t get_insert_delete_cost(wchar_t ch) const;
-    uint32_t get_replace_cost(wchar_t first, wchar_t second);
+    using InsertDeleteCosts = std::unordered_map<wchar_t, uint32_t, hashes::hash<wchar_t>>;
+    using ReplaceCosts = std::unordered_map<std::pair<wchar_t, wchar_t>, uint32_t,
+        hashes::hash<std::pair<wchar_t, wchar_t>>>;
+
+    void compile(const InsertDeleteCosts& insert_delete_costs, const ReplaceCosts& replace_costs);
+    uint16_t get_class(wchar_t ch) const;
+    void map_string(std::wstring_view input, MappedString& output) const;
+    uint32_t mapped_distance(const MappedString& left_input, const MappedString& right_input, uint32_t bound,
+            MetricWorkspace& workspace) const;
 
-    std::vector<uint32_t> buffer_src, buffer_dst;
     uint32_t default_insert_delete_ = 1;
     uint32_t default_replace_ = 1;
-    std::unordered_map<wchar_t, uint32_t, hashes::hash<wchar_t>> insert_delete_costs_;
-    std::unordered_map<std::pair<wchar_t, wchar_t>, uint32_t,
-        hashes::hash<std::pair<wchar_t, wchar_t>>> replace_costs_;
+    uint32_t min_insert_delete_ = 1;
+    uint32_t min_replace_ = 1;
     bool is_case_sensitive_ = true;
-    BloomCache<wchar_t, hashes::hash<wchar_t>> insert_delete_cache_;
-    BloomCache<std::pair<wchar_t, wchar_t>, hashes::hash<std::pair<wchar_t, wchar_t>>> replace_cache_;
+
+    // Characters mentioned in the config get their own classes starting from 1, all others share class 0.
+    size_t classes_count_ = 1;
+    std::vector<uint16_t> bmp_classes_;
+    std::unordered_map<wchar_t, uint16_t, hashes::hash<wchar_t>> other_classes_;
+    std::vector<uint32_t> insert_delete_costs_;
+    // classes_count_ x classes_count_ matrix of costs to replace a character with a different one
+    std::vector<uint32_t> replace_costs_;
 };
 
 
-uint32_t LevensteinMetric::operator()(const std::wstring& left_input, const std::wstring& right_input) {
-    const std::wstring& left = left_input.size() < right_input.size() ? left_input : right_input;
-    const std::wstring& right = left_input.size() >= right_input.size() ? left_input : right_input;
+uint32_t LevensteinMetric::operator()(std::wstring_view left_input, std::wstring_view right_input,
+        MetricWorkspace& workspace) const {
+    std::wstring_view left = left_input.size() < right_input.size() ? left_input : right_input;
+    std::wstring_view right = left_input.size() >= right_input.size() ? left_input : right_input;
+    if (workspace.pair_masks.Assign(left)) {
+        return bit_parallel::Distance(workspace.pair_masks, right);
+    }
+    auto& buffer_src = workspace.buffer_src;
+    auto& buffer_dst = workspace.buffer_dst;
 
     if (buffer_src.size() < left.size() + 1) {
         buffer_src.resize(left.size() + 1);
@@ -139,8 +251,115 @@ uint32_t LevensteinMetric::operator()(const std::wstring& left_input, const std:
 }
 
 
+uint32_t LevensteinMetric::Bounded(std::wstring_view left_input, std::wstring_view right_input, uint32_t bound,
+        MetricWorkspace& workspace) const {
+    std::wstring_view left = left_input.size() < right_input.size() ? left_input : right_input;
+    std::wstring_view right = left_input.size() >= right_input.size() ? left_input : right_input;
+    if (right.size() - left.size() > bound) {
+        return SaturatedBound(bound);
+    }
+    if (workspace.pair_masks.Assign(left)) {
+        return bit_parallel::Distance(workspace.pair_masks, right, bound);
+    }
+    return banded_distance(left, right, bound, workspace);
+}
+
+void LevensteinMetric::Prepare(std::wstring_view query, MetricWorkspace& workspace) const {
+    workspace.query = query;
+    workspace.is_query_masked = workspace.query_masks.Assign(query);
+}
+
+uint32_t LevensteinMetric::QueryBounded(std::wstring_view word, uint32_t bound, MetricWorkspace& workspace) const {
+    if (!workspace.is_query_masked) {
+        return Bounded(workspace.query, word, bound, workspace);
+    }
+    size_t length_difference = std::max(word.size(), workspace.query.size()) -
+            std::min(word.size(), workspace.query.size());
+    if (length_difference > bound) {
+        return SaturatedBound(bound);
+    }
+    return bit_parallel::Distance(workspace.query_masks, word, bound);
+}
+
+void LevensteinMetric::QueryBatch(const std::wstring_view* words, const uint32_t* bounds, size_t count,
+        uint32_t* distances, MetricWorkspace& workspace) const {
+    if (!workspace.is_query_masked) {
+        AbstractWStringMetric::QueryBatch(words, bounds, count, distances, workspace);
+        return;
+    }
+    bit_parallel::DistanceBatch(workspace.query_masks, words, count, distances);
+    for (size_t index = 0; index < count; ++index) {
+        distances[index] = std::min(distances[index], SaturatedBound(bounds[index]));
+    }
+}
+
+// The distance is symmetric, so the word becomes the pattern and the others are scored against it in SIMD lanes.
+void LevensteinMetric::BoundedBatch(std::wstring_view word, const std::wstring_view* others, const uint32_t* bounds,
+        size_t count, uint32_t* distances, MetricWorkspace& workspace) const {
+    if (!workspace.pair_masks.Assign(word)) {
+        AbstractWStringMetric::BoundedBatch(word, others, bounds, count, distances, workspace);
+        return;
+    }
+    bit_parallel::DistanceBatch(workspace.pair_masks, others, count, distances);
+    for (size_t index = 0; index < count; ++index) {
+        distances[index] = std::min(distances[index], SaturatedBound(bounds[index]));
+    }
+}
+
+uint32_t LevensteinMetric::banded_distance(std::wstring_view left, std::wstring_view right, uint32_t bound,
+        MetricWorkspace& workspace) const {
+    const uint32_t cap = SaturatedBound(bound);
+    auto& buffer_src = workspace.buffer_src;
+    auto& buffer_dst = workspace.buffer_dst;
+
+    if (buffer_src.size() < left.size() + 1) {
+        buffer_src.resize(left.size() + 1);
+        buffer_dst.resize(left.size() + 1);
+    }
+
+    // Only the diagonal band |i - j| <= bound is computed, cells outside of it are treated as cap.
+    for (size_t j = 0; j < left.size() + 1; ++j) {
+        buffer_src[j] = j < cap ? static_cast<uint32_t>(j) : cap;
+    }
+
+    for (size_t i = 1; i < right.size() + 1; ++i) {
+        size_t lo = i > bound ? i - bound : 0;
+        size_t hi = std::min(left.size(), i + static_cast<size_t>(bound));
+        uint32_t row_min = cap;
+        if (lo > 0) {
+            buffer_dst[lo - 1] = cap;
+        }
+        for (size_t j = lo; j <= hi; ++j) {
+            uint32_t value;
+            if (j == 0) {
+                value = static_cast<uint32_t>(i);
+            } else {
+                uint32_t substitution_const = (left[j - 1] == right[i - 1]) ? 0 : 1;
+                value = std::min(buffer_dst[j - 1] + 1, buffer_src[j] + 1);
+                value = std::min(value, substitution_const + buffer_src[j - 1]);
+            }
+            buffer_dst[j] = std::min(value, cap);
+            row_min = std::min(row_min, buffer_dst[j]);
+        }
+        if (hi < left.size()) {
+            buffer_dst[hi + 1] = cap;
+        }
+        if (row_min >= cap) {
+            return cap;
+        }
+        buffer_dst.swap(buffer_src);
+    }
+    return buffer_src[left.size()];
+}
+
+uint32_t Dist(const std::wstring& left_input, const std::wstring& right_input) {
+    static thread_local MetricWorkspace workspace;
+    return LevensteinMetric()(left_input, right_input, workspace);
+}
+
 WeightedLevensteinMetric::WeightedLevensteinMetric()
         : AbstractWStringMetric(), default_insert_delete_(1), default_replace_(1) {
+    compile({}, {});
 }
 
 WeightedLevensteinMetric::WeightedLevensteinMetric(const std::string& config_file_name)
@@ -151,13 +370,15 @@ WeightedLevensteinMetric::WeightedLevensteinMetric(const std::string& config_fil
             throw std::runtime_error(Poco::format("Metric config file \"%s\" can't be opened", config_file_name));
         }
 
-        std::wstring_convert<std::codecvt_utf8<wchar_t>> converter;
+        InsertDeleteCosts insert_delete_costs;
+        ReplaceCosts replace_costs;
         Parser parser;
         Object::Ptr config_object = parser.parse(config).extract<Object::Ptr>();
         // parse default section
         auto default_config = config_object->getObject("default");
         default_insert_delete_ = default_config->getValue<uint32_t>("insert_delete");
         default_replace_ = default_config->getValue<uint32_t>("replace");
+        min_insert_delete_ = default_insert_delete_;
         try {
             is_case_sensitive_ = default_config->getValue<bool>("case_sensitive");
         } catch (...) {
@@ -170,16 +391,16 @@ WeightedLevensteinMetric::WeightedLevensteinMetric(const std::string& config_fil
             auto object = insert_delete_array->getObject(index);
             try {
                 auto group_bytes = object->getValue<std::string>("group");
-                std::wstring group = converter.from_bytes(group_bytes);
+                std::wstring group = utf8::Decode(group_bytes);
                 if (!is_case_sensitive_) {
                     std::transform(group.begin(), group.end(), group.begin(), towlower);
                 }
 
                 auto cost = object->getValue<uint32_t>("cost");
 
+                min_insert_delete_ = std::min(min_insert_delete_, cost);
                 for (const auto& elem: group) {
-                    insert_delete_costs_[elem] = cost;
-                    insert_delete_cache_.Add(elem);
+                    insert_delete_costs[elem] = cost;
                 }
             } catch (std::exception& e) {
                 std::ostringstream log;
@@ -192,13 +413,13 @@ WeightedLevensteinMetric::WeightedLevensteinMetric(const std::string& config_fil
 
         // parse replace section
         auto replace_array = config_object->getArray("custom_replace");
-        for (size_t index = 0; index < insert_delete_array->size(); ++index) {
+        for (size_t index = 0; index < replace_array->size(); ++index) {
             auto object = replace_array->getObject(index);
             try {
                 auto first_group_bytes = object->getValue<std::string>("first_group");
-                std::wstring first_group = converter.from_bytes(first_group_bytes);
+                std::wstring first_group = utf8::Decode(first_group_bytes);
                 auto second_group_bytes = object->getValue<std::string>("second_group");
-                std::wstring second_group = converter.from_bytes(second_group_bytes);
+                std::wstring second_group = utf8::Decode(second_group_bytes);
                 auto cost = object->getValue<uint32_t>("cost");
                 if (!is_case_sensitive_) {
                     std::transform(first_group.begin(), first_group.end(), first_group.begin(), towlower);
@@ -206,10 +427,8 @@ WeightedLevensteinMetric::WeightedLevensteinMetric(const std::string& config_fil
                 }
                 for (const auto& first: first_group) {
                     for (const auto& second: second_group) {
-                        replace_costs_[std::make_pair(first, second)] = cost;
-                        replace_costs_[std::make_pair(second, first)] = cost;
-                        replace_cache_.Add(std::make_pair(first, second));
-                        replace_cache_.Add(std::make_pair(second, first));
+                        replace_costs[std::make_pair(first, second)] = cost;
+                        replace_costs[std::make_pair(second, first)] = cost;
                     }
                 }
             } catch (std::exception& e) {
@@ -220,74 +439,190 @@ WeightedLevensteinMetric::WeightedLevensteinMetric(const std::string& config_fil
                 throw std::runtime_error(log.str());
             }
         }
+        compile(insert_delete_costs, replace_costs);
     } catch (std::exception& e) {
         std::cerr << "Can't parse metric config file" << std::endl;
         throw e;
     }
 }
 
-uint32_t WeightedLevensteinMetric::get_insert_delete_cost(wchar_t ch) const {
-    if (!is_case_sensitive_) {
-        ch = towlower(ch);
+void WeightedLevensteinMetric::compile(const InsertDeleteCosts& insert_delete_costs,
+        const ReplaceCosts& replace_costs) {
+    std::vector<wchar_t> alphabet;
+    for (const auto& [ch, cost]: insert_delete_costs) {
+        alphabet.push_back(ch);
+    }
+    for (const auto& [chars, cost]: replace_costs) {
+        alphabet.push_back(chars.first);
+    }
+    std::sort(alphabet.begin(), alphabet.end());
+    alphabet.erase(std::unique(alphabet.begin(), alphabet.end()), alphabet.end());
+    if (alphabet.size() >= std::numeric_limits<uint16_t>::max()) {
+        throw std::runtime_error("Too many characters in metric config");
+    }
+
+    classes_count_ = alphabet.size() + 1;
+    bmp_classes_.assign(std::numeric_limits<uint16_t>::max() + 1, 0);
+    other_classes_.clear();
+    insert_delete_costs_.assign(classes_count_, default_insert_delete_);
+    replace_costs_.assign(classes_count_ * classes_count_, default_replace_);
+    for (size_t index = 0; index < alphabet.size(); ++index) {
+        auto char_class = static_cast<uint16_t>(index + 1);
+        if (static_cast<uint32_t>(alphabet[index]) < bmp_classes_.size()) {
+            bmp_classes_[alphabet[index]] = char_class;
+        } else {
+            other_classes_[alphabet[index]] = char_class;
+        }
     }
-    if (!insert_delete_cache_.Check(ch)) {
-        return default_insert_delete_;
+    for (const auto& [ch, cost]: insert_delete_costs) {
+        insert_delete_costs_[get_class(ch)] = cost;
     }
-    auto search = insert_delete_costs_.find(ch);
-    if (search != insert_delete_costs_.end()) {
-        return search->second;
-    } else {
-        return default_insert_delete_;
+    for (const auto& [chars, cost]: replace_costs) {
+        replace_costs_[get_class(chars.first) * classes_count_ + get_class(chars.second)] = cost;
     }
+    min_replace_ = *std::min_element(replace_costs_.begin(), replace_costs_.end());
 }
 
-uint32_t WeightedLevensteinMetric::get_replace_cost(wchar_t first, wchar_t second) {
-    if (!is_case_sensitive_) {
-        first = towlower(first);
-        second = towlower(second);
+std::string WeightedLevensteinMetric::Identity() const {
+    // FNV-1a of the compiled tables, which don't depend on the order of entries in the config
+    uint64_t hash = 14695981039346656037ull;
+    auto add = [&hash](uint64_t value) {
+        hash = (hash ^ value) * 1099511628211ull;
+    };
+    add(is_case_sensitive_);
+    add(classes_count_);
+    for (size_t ch = 0; ch < bmp_classes_.size(); ++ch) {
+        if (bmp_classes_[ch] != 0) {
+            add(ch);
+            add(bmp_classes_[ch]);
+        }
     }
-    if (first == second) {
-        return 0;
+    std::vector<std::pair<wchar_t, uint16_t>> other_classes(other_classes_.begin(), other_classes_.end());
+    std::sort(other_classes.begin(), other_classes.end());
+    for (const auto& [ch, char_class]: other_classes) {
+        add(static_cast<uint64_t>(ch));
+        add(char_class);
+    }
+    for (auto cost: insert_delete_costs_) {
+        add(cost);
     }
+    for (auto cost: replace_costs_) {
+        add(cost);
+    }
+    std::ostringstream identity;
+    identity << "weighted_levenstein:" << std::hex << hash;
+    return identity.str();
+}
 
-    if (!replace_cache_.Check(std::make_pair(first, second))) {
-        return default_replace_;
+uint16_t WeightedLevensteinMetric::get_class(wchar_t ch) const {
+    if (static_cast<uint32_t>(ch) < bmp_classes_.size()) {
+        return bmp_classes_[ch];
     }
-    auto search = replace_costs_.find(std::make_pair(first, second));
-    if (search != replace_costs_.end()) {
-        return search->second;
-    } else {
-        return default_replace_;
+    auto search = other_classes_.find(ch);
+    return search != other_classes_.end() ? search->second : 0;
+}
+
+void WeightedLevensteinMetric::map_string(std::wstring_view input, MappedString& output) const {
+    output.chars.resize(input.size());
+    output.classes.resize(input.size());
+    output.insert_delete_costs.resize(input.size());
+    for (size_t index = 0; index < input.size(); ++index) {
+        wchar_t ch = is_case_sensitive_ ? input[index] : static_cast<wchar_t>(towlower(input[index]));
+        uint16_t char_class = get_class(ch);
+        output.chars[index] = ch;
+        output.classes[index] = char_class;
+        output.insert_delete_costs[index] = insert_delete_costs_[char_class];
     }
 }
 
-uint32_t WeightedLevensteinMetric::operator()(const std::wstring& left_input, const std::wstring& right_input) {
-    const std::wstring& left = left_input.size() < right_input.size() ? left_input : right_input;
-    const std::wstring& right = left_input.size() >= right_input.size() ? left_input : right_input;
+uint32_t WeightedLevensteinMetric::operator()(std::wstring_view left_input, std::wstring_view right_input,
+        MetricWorkspace& workspace) const {
+    return Bounded(left_input, right_input, std::numeric_limits<uint32_t>::max(), workspace);
+}
 
-    if (buffer_src.size() < left.size() + 1) {
-        buffer_src.resize(left.size() + 1);
-        buffer_dst.resize(left.size() + 1);
+uint32_t WeightedLevensteinMetric::Bounded(std::wstring_view left_input, std::wstring_view right_input,
+        uint32_t bound, MetricWorkspace& workspace) const {
+    map_string(left_input, workspace.left_mapped);
+    map_string(right_input, workspace.right_mapped);
+    return mapped_distance(workspace.left_mapped, workspace.right_mapped, bound, workspace);
+}
+
+void WeightedLevensteinMetric::Prepare(std::wstring_view query, MetricWorkspace& workspace) const {
+    workspace.query = query;
+    map_string(query, workspace.query_mapped);
+}
+
+uint32_t WeightedLevensteinMetric::QueryBounded(std::wstring_view word, uint32_t bound,
+        MetricWorkspace& workspace) const {
+    map_string(word, workspace.right_mapped);
+    return mapped_distance(workspace.query_mapped, workspace.right_mapped, bound, workspace);
+}
+
+void WeightedLevensteinMetric::BoundedBatch(std::wstring_view word, const std::wstring_view* others,
+        const uint32_t* bounds, size_t count, uint32_t* distances, MetricWorkspace& workspace) const {
+    map_string(word, workspace.left_mapped);
+    for (size_t index = 0; index < count; ++index) {
+        map_string(others[index], workspace.right_mapped);
+        distances[index] = mapped_distance(workspace.left_mapped, workspace.right_mapped, bounds[index], workspace);
     }
+}
 
-    for (uint32_t i = 0; i < left.size() + 1; ++i) {
-        buffer_src[i] = i;
+uint32_t WeightedLevensteinMetric::mapped_distance(const MappedString& left_input, const MappedString& right_input,
+        uint32_t bound, MetricWorkspace& workspace) const {
+    const MappedString& left = left_input.chars.size() < right_input.chars.size() ? left_input : right_input;
+    const MappedString& right = left_input.chars.size() >= right_input.chars.size() ? left_input : right_input;
+    const size_t left_size = left.chars.size();
+    const size_t right_size = right.chars.size();
+    const uint32_t cap = SaturatedBound(bound);
+    // every cell farther than band from the diagonal needs more than bound / min_insert_delete_ insertions
+    const size_t band = min_insert_delete_ == 0 ? std::numeric_limits<size_t>::max() : bound / min_insert_delete_;
+    if (right_size - left_size > band) {
+        return cap;
     }
+    auto& buffer_src = workspace.buffer_src;
+    auto& buffer_dst = workspace.buffer_dst;
 
-    for (size_t i = 1; i < right.size() + 1; ++i) {
-        for (size_t j = 0; j < left.size() + 1; ++j) {
+    if (buffer_src.size() < left_size + 1) {
+        buffer_src.resize(left_size + 1);
+        buffer_dst.resize(left_size + 1);
+    }
+
+    buffer_src[0] = 0;
+    for (size_t j = 1; j < left_size + 1; ++j) {
+        buffer_src[j] = std::min(buffer_src[j - 1] + left.insert_delete_costs[j - 1], cap);
+    }
+
+    for (size_t i = 1; i < right_size + 1; ++i) {
+        size_t lo = i > band ? i - band : 0;
+        size_t hi = band >= left_size ? left_size : std::min(left_size, i + band);
+        const wchar_t right_char = right.chars[i - 1];
+        const uint32_t right_cost = right.insert_delete_costs[i - 1];
+        const uint32_t* replace_row = replace_costs_.data() + right.classes[i - 1] * classes_count_;
+        uint32_t row_min = cap;
+        if (lo > 0) {
+            buffer_dst[lo - 1] = cap;
+        }
+        for (size_t j = lo; j <= hi; ++j) {
+            uint32_t value;
             if (j == 0) {
-                buffer_dst[j] = i;
+                value = buffer_src[j] + right_cost;
             } else {
-                uint32_t substitution = buffer_src[j - 1] + get_replace_cost(left[i - 1], right[j - 1]);
-                uint32_t right_insert = buffer_src[j] + get_insert_delete_cost(right[j - 1]);
-                uint32_t left_insert = buffer_dst[j - 1] + get_insert_delete_cost(left[i - 1]);
-
-                buffer_dst[j] = std::min(right_insert, left_insert);
-                buffer_dst[j] = std::min(buffer_dst[j], substitution);
+                uint32_t replace_cost = left.chars[j - 1] == right_char ? 0 : replace_row[left.classes[j - 1]];
+                uint32_t substitution = buffer_src[j - 1] + replace_cost;
+                uint32_t right_insert = buffer_src[j] + right_cost;
+                uint32_t left_insert = buffer_dst[j - 1] + left.insert_delete_costs[j - 1];
+                value = std::min(std::min(right_insert, left_insert), substitution);
             }
+            buffer_dst[j] = std::min(value, cap);
+            row_min = std::min(row_min, buffer_dst[j]);
+        }
+        if (hi < left_size) {
+            buffer_dst[hi + 1] = cap;
+        }
+        if (row_min >= cap) {
+            return cap;
         }
         buffer_dst.swap(buffer_src);
     }
-    return buffer_src[left.size()];
+    return buffer_src[left_size];
 }
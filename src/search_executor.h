@@ -0,0 +1,203 @@
+#pragma once
+
+#include <algorithm>
+#include <memory>
+#include <vector>
+
+#include "dictionary_holder.h"
+#include "thread_pool.h"
+#include "caches.h"
+#include "telemetry.h"
+
+
+// Results are cached for the exact query of a given dictionary state: generation changes on reload and version on
+// every update, so stale entries are never hit again and get evicted.
+// Generations and versions are counted per dictionary, so the key names the dictionary too.
+struct SearchCacheKey {
+    std::wstring word;
+    uint32_t tolerance;
+    size_t limit;
+    uint32_t dictionary;
+    uint64_t generation;
+    uint64_t version;
+
+    bool operator==(const SearchCacheKey& other) const {
+        return word == other.word && tolerance == other.tolerance && limit == other.limit &&
+                dictionary == other.dictionary && generation == other.generation && version == other.version;
+    }
+};
+
+struct SearchCacheKeyHash {
+    size_t operator()(const SearchCacheKey& key) const {
+        size_t hash = std::hash<std::wstring>()(key.word);
+        for (uint64_t value: {uint64_t(key.tolerance), uint64_t(key.limit), uint64_t(key.dictionary), key.generation,
+                key.version}) {
+            hash = (hash ^ value) * 1099511628211ull;
+        }
+        return hash;
+    }
+};
+
+using SearchResults = std::shared_ptr<const std::vector<SearchResult>>;
+using SearchCache = ShardedClockCache<SearchCacheKey, SearchResults, SearchCacheKeyHash>;
+
+
+// Runs batches of queries for the request handlers: looks results up in the cache, spreads the rest over the
+// pool in chunks and searches queries of every chunk to the same dictionary in one tree walk. The pool and the
+// cache are shared by all dictionaries.
+class SearchExecutor {
+public:
+    // batches up to this size run inline on the calling thread
+    static constexpr size_t kChunkSize = 32;
+
+    // Dictionary a request is served from, with its generation and version read before it, so that results
+    // are never cached as newer than they are.
+    struct DictionaryState {
+        uint64_t generation;
+        uint64_t version;
+        std::shared_ptr<Dictionary> dictionary;
+    };
+
+    // States of all dictionaries, indexed as in the registry.
+    struct Snapshot {
+        std::vector<DictionaryState> dictionaries;
+    };
+
+    struct Results {
+        std::vector<SearchResults> results;
+        // time of the search in the tree, zero for results taken from the cache
+        std::vector<uint64_t> microseconds;
+        // nonzero for queries whose budget ran out, char rather than bool as chunks fill it concurrently
+        std::vector<char> truncated;
+    };
+
+    // Server-wide bounds of a single query, 0 means none. Bounds passed with a query may only be tighter.
+    struct Limits {
+        uint64_t deadline_ms;
+        uint64_t max_nodes_visited;
+    };
+
+    // cache may be null, which disables caching
+    SearchExecutor(std::shared_ptr<DictionaryRegistry> dictionaries, std::shared_ptr<ThreadPool> thread_pool,
+            std::shared_ptr<SearchCache> cache, Limits limits)
+        : dictionaries_(std::move(dictionaries)), thread_pool_(std::move(thread_pool)),
+          cache_(std::move(cache)), limits_(limits) {
+    }
+
+    [[nodiscard]] Snapshot TakeSnapshot() const {
+        Snapshot snapshot;
+        snapshot.dictionaries.reserve(dictionaries_->Size());
+        for (uint32_t index = 0; index < dictionaries_->Size(); ++index) {
+            const auto& holder = dictionaries_->Holder(index);
+            DictionaryState state{holder->Generation(), 0, holder->Get()};
+            state.version = state.dictionary->Version();
+            snapshot.dictionaries.push_back(std::move(state));
+        }
+        return snapshot;
+    }
+
+    [[nodiscard]] const std::shared_ptr<DictionaryRegistry>& Dictionaries() const {
+        return dictionaries_;
+    }
+
+    [[nodiscard]] const std::shared_ptr<SearchCache>& Cache() const {
+        return cache_;
+    }
+
+    // Truncated results are returned but never cached, complete ones are cached whatever the bounds of the query.
+    // Query i is searched in dictionary number dictionaries[i], all of them in the default one if it's empty.
+    Results Search(const Snapshot& snapshot, const std::vector<SearchQuery>& queries,
+            const std::vector<uint32_t>& dictionaries = {}) const {
+        Results batch{std::vector<SearchResults>(queries.size()), std::vector<uint64_t>(queries.size(), 0),
+                std::vector<char>(queries.size(), 0)};
+        auto submit_time = telemetry::Clock::now();
+        thread_pool_->ParallelFor(queries.size(), kChunkSize, [&](size_t begin, size_t end) {
+            uint64_t waited = telemetry::MicrosecondsSince(submit_time);
+            telemetry::Add(telemetry::kQueueWaitMicroseconds, waited);
+            telemetry::Observe(telemetry::kQueueWait, waited);
+            telemetry::Add(telemetry::kQueries, end - begin);
+
+            std::vector<SearchCacheKey> keys;
+            std::vector<size_t> missed;
+            for (size_t index = begin; index < end; ++index) {
+                if (cache_ != nullptr) {
+                    const SearchQuery& query = queries[index];
+                    uint32_t dictionary = dictionary_of(dictionaries, index);
+                    const DictionaryState& state = snapshot.dictionaries[dictionary];
+                    keys.push_back({query.word, query.tolerance, query.limit, dictionary, state.generation,
+                            state.version});
+                    if (cache_->Get(keys.back(), batch.results[index])) {
+                        continue;
+                    }
+                }
+                missed.push_back(index);
+            }
+            telemetry::Add(telemetry::kCacheHits, end - begin - missed.size());
+            telemetry::Add(telemetry::kCacheMisses, missed.size());
+            if (missed.empty()) {
+                return;
+            }
+            // missed queries are searched in one walk per dictionary
+            std::stable_sort(missed.begin(), missed.end(), [&](size_t left, size_t right) {
+                return dictionary_of(dictionaries, left) < dictionary_of(dictionaries, right);
+            });
+            SearchStats stats;
+            uint64_t results_count = 0, truncated_count = 0;
+            for (size_t group_begin = 0, group_end = 0; group_begin < missed.size(); group_begin = group_end) {
+                uint32_t dictionary = dictionary_of(dictionaries, missed[group_begin]);
+                std::vector<SearchQuery> missed_queries;
+                for (group_end = group_begin; group_end < missed.size() &&
+                        dictionary_of(dictionaries, missed[group_end]) == dictionary; ++group_end) {
+                    missed_queries.push_back(queries[missed[group_end]]);
+                    SearchQuery& query = missed_queries.back();
+                    query.deadline_ms = tighter(query.deadline_ms, limits_.deadline_ms);
+                    query.max_nodes_visited = tighter(query.max_nodes_visited, limits_.max_nodes_visited);
+                }
+
+                auto start_time = telemetry::Clock::now();
+                auto found = snapshot.dictionaries[dictionary].dictionary->FindSimilar(missed_queries);
+                // queries of a chunk are searched in one walk, so each of them took the time of the walk
+                uint64_t microseconds = telemetry::MicrosecondsSince(start_time);
+                telemetry::Add(telemetry::kSearchMicroseconds, microseconds);
+                telemetry::Observe(telemetry::kSearchWalkDuration, microseconds);
+                for (size_t position = 0; position < found.size(); ++position) {
+                    size_t index = missed[group_begin + position];
+                    stats.nodes_visited += found[position].stats.nodes_visited;
+                    stats.metric_evaluations += found[position].stats.metric_evaluations;
+                    stats.subtrees_pruned += found[position].stats.subtrees_pruned;
+                    results_count += found[position].results.size();
+                    truncated_count += found[position].is_truncated;
+
+                    batch.results[index] =
+                            std::make_shared<const std::vector<SearchResult>>(std::move(found[position].results));
+                    batch.microseconds[index] = microseconds;
+                    batch.truncated[index] = found[position].is_truncated;
+                    if (cache_ != nullptr && !found[position].is_truncated) {
+                        cache_->Put(keys[index - begin], batch.results[index]);
+                    }
+                }
+            }
+            telemetry::Add(telemetry::kNodesVisited, stats.nodes_visited);
+            telemetry::Add(telemetry::kMetricEvaluations, stats.metric_evaluations);
+            telemetry::Add(telemetry::kSubtreesPruned, stats.subtrees_pruned);
+            telemetry::Add(telemetry::kResults, results_count);
+            telemetry::Add(telemetry::kTruncatedQueries, truncated_count);
+        });
+        return batch;
+    }
+
+private:
+    [[nodiscard]] uint32_t dictionary_of(const std::vector<uint32_t>& dictionaries, size_t index) const {
+        return dictionaries.empty() ? dictionaries_->DefaultIndex() : dictionaries[index];
+    }
+
+    // the tighter of two bounds, where 0 means no bound
+    static uint64_t tighter(uint64_t bound, uint64_t other) {
+        return bound == 0 || (other != 0 && other < bound) ? other : bound;
+    }
+
+    std::shared_ptr<DictionaryRegistry> dictionaries_;
+    std::shared_ptr<ThreadPool> thread_pool_;
+    std::shared_ptr<SearchCache> cache_;
+    Limits limits_;
+};
@@ -0,0 +1,259 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <fstream>
+#include <future>
+#include <iostream>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include <Poco/File.h>
+#include <Poco/Format.h>
+
+#include "bk_tree.hpp"
+#include "thread_pool.h"
+
+
+// Dictionary split by word hash into independent trees. Shards are built in parallel and are shallower than a tree
+// of the whole dictionary, and a query searches all of them at once on the pool, then merges their sorted results.
+// Updates go to the shard the word hashes to, so every word is in one shard only.
+class ShardedDictionary : public Dictionary {
+public:
+    using Shards = std::vector<std::unique_ptr<Dictionary>>;
+
+    static constexpr const char* kManifestTag = "bk_tree_shards";
+
+    ShardedDictionary(Shards shards, std::shared_ptr<ThreadPool> thread_pool)
+            : shards_(std::move(shards)), thread_pool_(std::move(thread_pool)) {
+        if (shards_.empty()) {
+            throw std::runtime_error("Sharded dictionary needs at least one shard");
+        }
+    }
+
+    // Stable across processes, so shards saved to index files keep matching the words routed to them.
+    static size_t ShardOf(std::wstring_view word, size_t shards_count) {
+        uint64_t hash = 0xcbf29ce484222325ull;
+        for (wchar_t ch: word) {
+            hash = (hash ^ static_cast<uint32_t>(ch)) * 0x100000001b3ull;
+        }
+        return static_cast<size_t>((hash ^ (hash >> 32)) % shards_count);
+    }
+
+    static std::string ShardFileName(const std::string& index_file_name, size_t shard) {
+        return Poco::format("%s.%z", index_file_name, shard);
+    }
+
+    // Reads the dictionary once and builds its shards in parallel, each on an even share of the threads.
+    static std::vector<std::unique_ptr<BKTree>> Build(const std::string& dictionary_file_name,
+            const std::shared_ptr<const AbstractWStringMetric>& metric, size_t shards_count,
+            size_t threads_count = std::thread::hardware_concurrency()) {
+        threads_count = std::max<size_t>(1, threads_count);
+        std::vector<DictionaryEntries> partitions(shards_count);
+        for (auto& entry: BKTree::Read(dictionary_file_name, threads_count)) {
+            partitions[ShardOf(entry.first, shards_count)].push_back(std::move(entry));
+        }
+        std::vector<std::future<std::unique_ptr<BKTree>>> building;
+        for (auto& partition: partitions) {
+            building.push_back(std::async(std::launch::async, [&partition, &metric, shards_count, threads_count]() {
+                return std::make_unique<BKTree>(std::move(partition), metric,
+                        std::max<size_t>(1, threads_count / shards_count));
+            }));
+        }
+        return wait_all(building);
+    }
+
+    // Writes every shard to its own file, then the manifest with the number of shards to index_file_name itself.
+    // The manifest goes last and shard files left from a build with more shards are removed, so an interrupted
+    // or stale build fails to load instead of routing words to wrong shards.
+    static void SaveIndex(const std::vector<std::unique_ptr<BKTree>>& shards, const std::string& index_file_name) {
+        Poco::File manifest_file(index_file_name);
+        if (manifest_file.exists()) {
+            manifest_file.remove();
+        }
+        for (size_t shard = 0; shard < shards.size(); ++shard) {
+            std::string shard_file_name = ShardFileName(index_file_name, shard);
+            std::cerr << Poco::format("Writing bk_tree index to %s... ", shard_file_name);
+            shards[shard]->SaveIndex(shard_file_name);
+            std::cerr << "Done!" << std::endl;
+        }
+        for (size_t shard = shards.size(); Poco::File(ShardFileName(index_file_name, shard)).exists(); ++shard) {
+            Poco::File(ShardFileName(index_file_name, shard)).remove();
+        }
+        std::ofstream manifest(index_file_name, std::ios::trunc);
+        manifest << kManifestTag << " " << shards.size() << std::endl;
+        manifest.close();
+        if (!manifest) {
+            throw std::runtime_error(Poco::format("Can't write index file \"%s\"", index_file_name));
+        }
+    }
+
+    // Maps shards written by SaveIndex. Fails if the manifest records another number of shards or if some shard
+    // file is missing or extra.
+    static std::vector<std::unique_ptr<BKTree>> Load(const std::string& index_file_name,
+            const std::shared_ptr<const AbstractWStringMetric>& metric, size_t shards_count) {
+        size_t saved_shards_count = read_manifest(index_file_name);
+        if (saved_shards_count != shards_count) {
+            throw std::runtime_error(Poco::format("Index \"%s\" has %z shards, but %z are expected",
+                    index_file_name, saved_shards_count, shards_count));
+        }
+        for (size_t shard = 0; shard < shards_count; ++shard) {
+            if (!Poco::File(ShardFileName(index_file_name, shard)).exists()) {
+                throw std::runtime_error(Poco::format("Shard file \"%s\" is missing",
+                        ShardFileName(index_file_name, shard)));
+            }
+        }
+        if (Poco::File(ShardFileName(index_file_name, shards_count)).exists()) {
+            throw std::runtime_error(Poco::format("Index \"%s\" has %z shards, but extra shard file \"%s\" exists",
+                    index_file_name, shards_count, ShardFileName(index_file_name, shards_count)));
+        }
+        std::vector<std::future<std::unique_ptr<BKTree>>> loading;
+        for (size_t shard = 0; shard < shards_count; ++shard) {
+            loading.push_back(std::async(std::launch::async, [&index_file_name, &metric, shard]() {
+                return std::make_unique<BKTree>(metric, ShardFileName(index_file_name, shard));
+            }));
+        }
+        return wait_all(loading);
+    }
+
+    bool Insert(const std::wstring& data, uint32_t priority=1) override {
+        return shard_of(data).Insert(data, priority);
+    }
+
+    bool IncreasePriority(const std::wstring& data, uint32_t priority) override {
+        return shard_of(data).IncreasePriority(data, priority);
+    }
+
+    bool Delete(const std::wstring& data) override {
+        return shard_of(data).Delete(data);
+    }
+
+    // Versions of shards only grow, and so does their sum.
+    [[nodiscard]] uint64_t Version() const override {
+        uint64_t version = 0;
+        for (const auto& shard: shards_) {
+            version += shard->Version();
+        }
+        return version;
+    }
+
+    [[nodiscard]] std::vector<SearchResult> FindSimilar(const std::wstring& data, uint32_t tolerance,
+            size_t limit = 0) const override {
+        std::vector<std::vector<SearchResult>> found(shards_.size());
+        thread_pool_->ParallelFor(shards_.size(), 1, [&](size_t begin, size_t) {
+            found[begin] = shards_[begin]->FindSimilar(data, tolerance, limit);
+        });
+        return merge(found, limit);
+    }
+
+    // Every shard searches the whole batch in its own walks, so a batch as small as a single query still runs
+    // on as many threads as there are shards. The node budget of a query is split evenly between shards.
+    [[nodiscard]] std::vector<SearchOutcome> FindSimilar(const std::vector<SearchQuery>& queries) const override {
+        std::vector<SearchQuery> shard_queries(queries);
+        for (auto& query: shard_queries) {
+            if (query.max_nodes_visited != 0) {
+                query.max_nodes_visited = (query.max_nodes_visited + shards_.size() - 1) / shards_.size();
+            }
+        }
+        std::vector<std::vector<SearchOutcome>> found(shards_.size());
+        thread_pool_->ParallelFor(shards_.size(), 1, [&](size_t begin, size_t) {
+            found[begin] = shards_[begin]->FindSimilar(shard_queries);
+        });
+
+        std::vector<SearchOutcome> outcomes(queries.size());
+        std::vector<std::vector<SearchResult>> results(shards_.size());
+        for (size_t index = 0; index < queries.size(); ++index) {
+            SearchOutcome& outcome = outcomes[index];
+            outcome.is_truncated = false;
+            for (size_t shard = 0; shard < shards_.size(); ++shard) {
+                SearchOutcome& shard_outcome = found[shard][index];
+                results[shard] = std::move(shard_outcome.results);
+                outcome.is_truncated = outcome.is_truncated || shard_outcome.is_truncated;
+                outcome.stats.nodes_visited += shard_outcome.stats.nodes_visited;
+                outcome.stats.metric_evaluations += shard_outcome.stats.metric_evaluations;
+                outcome.stats.subtrees_pruned += shard_outcome.stats.subtrees_pruned;
+            }
+            outcome.results = merge(results, queries[index].limit);
+        }
+        return outcomes;
+    }
+
+private:
+    static size_t read_manifest(const std::string& index_file_name) {
+        std::ifstream manifest(index_file_name);
+        if (!manifest) {
+            throw std::runtime_error(Poco::format("Index file \"%s\" can't be opened", index_file_name));
+        }
+        std::string tag;
+        size_t shards_count = 0;
+        if (!(manifest >> tag >> shards_count) || tag != kManifestTag || shards_count == 0) {
+            throw std::runtime_error(Poco::format("File \"%s\" is not a sharded bk_tree index", index_file_name));
+        }
+        return shards_count;
+    }
+
+    // waits for every shard before rethrowing the first failure
+    static std::vector<std::unique_ptr<BKTree>> wait_all(std::vector<std::future<std::unique_ptr<BKTree>>>& futures) {
+        std::vector<std::unique_ptr<BKTree>> shards;
+        std::exception_ptr error;
+        for (auto& future: futures) {
+            try {
+                shards.push_back(future.get());
+            } catch (...) {
+                error = error == nullptr ? std::current_exception() : error;
+            }
+        }
+        if (error != nullptr) {
+            std::rethrow_exception(error);
+        }
+        return shards;
+    }
+
+    Dictionary& shard_of(std::wstring_view word) const {
+        return *shards_[ShardOf(word, shards_.size())];
+    }
+
+    // K-way merge of lists sorted by SearchResultCollector::IsBetter, keeping the best limit results if it's nonzero.
+    static std::vector<SearchResult> merge(std::vector<std::vector<SearchResult>>& lists, size_t limit) {
+        struct Head {
+            size_t list;
+            size_t position;
+        };
+        std::vector<Head> heads;
+        size_t total = 0;
+        for (size_t list = 0; list < lists.size(); ++list) {
+            if (!lists[list].empty()) {
+                heads.push_back({list, 0});
+                total += lists[list].size();
+            }
+        }
+        if (heads.size() == 1) {
+            auto& results = lists[heads.front().list];
+            results.resize(limit == 0 ? results.size() : std::min(limit, results.size()));
+            return std::move(results);
+        }
+        // the best head on top of the heap
+        auto is_worse = [&lists](const Head& left, const Head& right) {
+            return SearchResultCollector::IsBetter(lists[right.list][right.position], lists[left.list][left.position]);
+        };
+        std::make_heap(heads.begin(), heads.end(), is_worse);
+        std::vector<SearchResult> merged;
+        merged.reserve(limit == 0 ? total : std::min(limit, total));
+        while (!heads.empty() && (limit == 0 || merged.size() < limit)) {
+            std::pop_heap(heads.begin(), heads.end(), is_worse);
+            Head& head = heads.back();
+            merged.push_back(std::move(lists[head.list][head.position]));
+            if (++head.position < lists[head.list].size()) {
+                std::push_heap(heads.begin(), heads.end(), is_worse);
+            } else {
+                heads.pop_back();
+            }
+        }
+        return merged;
+    }
+
+    Shards shards_;
+    std::shared_ptr<ThreadPool> thread_pool_;
+};
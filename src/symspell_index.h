@@ -0,0 +1,258 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <iostream>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include <Poco/Format.h>
+
+#include "bk_tree.hpp"
+
+
+// Symmetric delete index (as in SymSpell) over the words of a frozen BKTree. If two words are within Levenshtein
+// distance d, deleting at most d characters from each of them gives a common string, so a query looks up strings
+// made by up to tolerance deletions from it among such strings of dictionary words and verifies the candidates
+// with the metric. The cost depends on the length of the query and not on the size of the dictionary.
+//
+// Deletion strings are stored by 64-bit hash only: a collision adds candidates but never loses a word. Postings
+// are node indices of the frozen tree, so priorities and deletions applied to the tree are seen by the index as
+// well, and words inserted after freezing are searched in the delta tree. Queries with tolerances above
+// max_distance, and all queries if the metric isn't the plain LevensteinMetric, are searched in the tree.
+class SymSpellIndex : public Dictionary {
+public:
+    SymSpellIndex(std::unique_ptr<BKTree> tree, uint32_t max_distance)
+            : tree_(std::move(tree)), max_distance_(max_distance) {
+        if (dynamic_cast<const LevensteinMetric*>(tree_->metric_.get()) == nullptr) {
+            std::cerr << "Symmetric delete index needs the unweighted metric, serving from bk_tree" << std::endl;
+            is_enabled_ = false;
+            return;
+        }
+        const FrozenBKTree* frozen = tree_->frozen_.get();
+        if (frozen == nullptr) {
+            return;
+        }
+        std::cerr << Poco::format("Building symmetric delete index up to distance %u... ", max_distance_);
+        build(*frozen);
+        std::cerr << Poco::format("Done! %z deletion strings, %z postings", keys_count_, postings_.size())
+                  << std::endl;
+    }
+
+    bool Insert(const std::wstring& data, uint32_t priority=1) override {
+        return tree_->Insert(data, priority);
+    }
+
+    bool IncreasePriority(const std::wstring& data, uint32_t priority) override {
+        return tree_->IncreasePriority(data, priority);
+    }
+
+    bool Delete(const std::wstring& data) override {
+        return tree_->Delete(data);
+    }
+
+    [[nodiscard]] uint64_t Version() const override {
+        return tree_->Version();
+    }
+
+    [[nodiscard]] std::vector<SearchResult> FindSimilar(const std::wstring& data, uint32_t tolerance,
+            size_t limit = 0) const override {
+        if (!is_indexed(tolerance)) {
+            return tree_->FindSimilar(data, tolerance, limit);
+        }
+        static thread_local MetricWorkspace workspace;
+        SearchResultCollector results(tolerance, limit);
+        find_similar(data, results, workspace);
+        return results.Release();
+    }
+
+    // Queries the index can't serve are searched in the tree in one batch.
+    [[nodiscard]] std::vector<SearchOutcome> FindSimilar(const std::vector<SearchQuery>& queries) const override {
+        static thread_local MetricWorkspace workspace;
+        std::vector<SearchOutcome> outcomes(queries.size());
+        std::vector<SearchQuery> tree_queries;
+        std::vector<size_t> tree_indices;
+        for (size_t index = 0; index < queries.size(); ++index) {
+            const SearchQuery& query = queries[index];
+            if (!is_indexed(query.tolerance)) {
+                tree_queries.push_back(query);
+                tree_indices.push_back(index);
+                continue;
+            }
+            SearchResultCollector results(query.tolerance, query.limit, query.deadline_ms, query.max_nodes_visited);
+            find_similar(query.word, results, workspace);
+            outcomes[index] = {results.Release(), results.IsTruncated(), results.Stats()};
+        }
+        if (!tree_queries.empty()) {
+            auto tree_outcomes = tree_->FindSimilar(tree_queries);
+            for (size_t position = 0; position < tree_indices.size(); ++position) {
+                outcomes[tree_indices[position]] = std::move(tree_outcomes[position]);
+            }
+        }
+        return outcomes;
+    }
+
+private:
+    static constexpr uint64_t kEmptyKey = 0;
+
+    [[nodiscard]] bool is_indexed(uint32_t tolerance) const {
+        return is_enabled_ && tolerance <= max_distance_;
+    }
+
+    static uint64_t hash(std::wstring_view word) {
+        uint64_t hash = 0xcbf29ce484222325ull ^ word.size();
+        for (wchar_t ch: word) {
+            hash = (hash ^ static_cast<uint32_t>(ch)) * 0x100000001b3ull;
+        }
+        // final mix of MurmurHash3, so that the low bits selecting a slot depend on all characters
+        hash ^= hash >> 33;
+        hash *= 0xff51afd7ed558ccdull;
+        hash ^= hash >> 33;
+        hash *= 0xc4ceb9fe1a85ec53ull;
+        hash ^= hash >> 33;
+        return hash == kEmptyKey ? 1 : hash;
+    }
+
+    // Appends hashes of all distinct strings made by deleting up to max_deletions characters from the word,
+    // the word itself included.
+    static void collect_deletions(std::wstring_view word, uint32_t max_deletions, std::vector<uint64_t>& hashes) {
+        hashes.clear();
+        std::wstring buffer(word);
+        append_deletions(buffer, 0, max_deletions, hashes);
+        std::sort(hashes.begin(), hashes.end());
+        hashes.erase(std::unique(hashes.begin(), hashes.end()), hashes.end());
+    }
+
+    // deletions are made at nondecreasing positions, so every set of deleted positions is visited once
+    static void append_deletions(std::wstring& buffer, size_t first, uint32_t max_deletions,
+            std::vector<uint64_t>& hashes) {
+        hashes.push_back(hash(buffer));
+        if (max_deletions == 0) {
+            return;
+        }
+        for (size_t position = first; position < buffer.size(); ++position) {
+            wchar_t ch = buffer[position];
+            buffer.erase(position, 1);
+            append_deletions(buffer, position, max_deletions - 1, hashes);
+            buffer.insert(position, 1, ch);
+        }
+    }
+
+    // Slot of the key, or of the empty slot where it belongs.
+    [[nodiscard]] size_t find_slot(uint64_t key) const {
+        size_t mask = keys_.size() - 1;
+        size_t slot = key & mask;
+        while (keys_[slot] != key && keys_[slot] != kEmptyKey) {
+            slot = (slot + 1) & mask;
+        }
+        return slot;
+    }
+
+    // Two passes over the words: the first one places distinct deletion strings into an open addressing table
+    // counting words having each of them, the second one lays postings out slot by slot.
+    void build(const FrozenBKTree& frozen) {
+        std::vector<uint64_t> hashes;
+        std::vector<uint32_t> counts;
+        keys_.assign(1024, kEmptyKey);
+        counts.assign(keys_.size(), 0);
+        size_t postings_count = 0;
+        for (uint32_t node_index = 0; node_index < frozen.Size(); ++node_index) {
+            collect_deletions(frozen.Word(node_index), max_distance_, hashes);
+            for (uint64_t key: hashes) {
+                // kept at most half full, so probe sequences stay short
+                if (2 * (keys_count_ + 1) > keys_.size()) {
+                    grow(counts);
+                }
+                size_t slot = find_slot(key);
+                if (keys_[slot] == kEmptyKey) {
+                    keys_[slot] = key;
+                    ++keys_count_;
+                }
+                ++counts[slot];
+            }
+            postings_count += hashes.size();
+        }
+        if (postings_count > std::numeric_limits<uint32_t>::max()) {
+            throw std::runtime_error(Poco::format("Too many deletion strings (%z) for the index", postings_count));
+        }
+
+        offsets_.resize(keys_.size() + 1);
+        offsets_[0] = 0;
+        for (size_t slot = 0; slot < keys_.size(); ++slot) {
+            offsets_[slot + 1] = offsets_[slot] + counts[slot];
+        }
+        std::vector<uint32_t> ends(offsets_.begin(), offsets_.end() - 1);
+        postings_.resize(postings_count);
+        for (uint32_t node_index = 0; node_index < frozen.Size(); ++node_index) {
+            collect_deletions(frozen.Word(node_index), max_distance_, hashes);
+            for (uint64_t key: hashes) {
+                postings_[ends[find_slot(key)]++] = node_index;
+            }
+        }
+    }
+
+    void grow(std::vector<uint32_t>& counts) {
+        std::vector<uint64_t> keys(keys_.size() * 2, kEmptyKey);
+        std::vector<uint32_t> grown_counts(keys.size(), 0);
+        keys.swap(keys_);
+        for (size_t slot = 0; slot < keys.size(); ++slot) {
+            if (keys[slot] != kEmptyKey) {
+                size_t new_slot = find_slot(keys[slot]);
+                keys_[new_slot] = keys[slot];
+                grown_counts[new_slot] = counts[slot];
+            }
+        }
+        counts.swap(grown_counts);
+    }
+
+    void find_similar(const std::wstring& data, SearchResultCollector& results, MetricWorkspace& workspace) const {
+        const FrozenBKTree* frozen = tree_->frozen_.get();
+        if (frozen != nullptr && keys_count_ != 0) {
+            static thread_local std::vector<uint64_t> hashes;
+            static thread_local std::vector<uint32_t> candidates;
+            collect_deletions(data, results.Tolerance(), hashes);
+            candidates.clear();
+            for (uint64_t key: hashes) {
+                size_t slot = find_slot(key);
+                if (keys_[slot] == key) {
+                    candidates.insert(candidates.end(), postings_.begin() + offsets_[slot],
+                            postings_.begin() + offsets_[slot + 1]);
+                }
+            }
+            std::sort(candidates.begin(), candidates.end());
+            candidates.erase(std::unique(candidates.begin(), candidates.end()), candidates.end());
+
+            tree_->metric_->Prepare(data, workspace);
+            uint64_t evaluations = 0;
+            for (uint32_t node_index: candidates) {
+                if (!results.Visit()) {
+                    break;
+                }
+                std::wstring_view word = frozen->Word(node_index);
+                size_t length_difference = word.size() > data.size() ? word.size() - data.size() :
+                        data.size() - word.size();
+                if (length_difference > results.Tolerance() || frozen->IsDeleted(node_index)) {
+                    continue;
+                }
+                ++evaluations;
+                uint32_t distance = tree_->metric_->QueryBounded(word, results.Tolerance(), workspace);
+                results.Add(word, distance, frozen->Priority(node_index));
+            }
+            results.CountEvaluations(evaluations);
+        }
+        tree_->find_in_delta(data, results, workspace);
+    }
+
+    std::unique_ptr<BKTree> tree_;
+    uint32_t max_distance_;
+    bool is_enabled_ = true;
+
+    // open addressing table of deletion string hashes, postings of keys_[slot] are
+    // postings_[offsets_[slot], offsets_[slot + 1])
+    std::vector<uint64_t> keys_;
+    std::vector<uint32_t> offsets_;
+    std::vector<uint32_t> postings_;
+    size_t keys_count_ = 0;
+};
@@ -0,0 +1,211 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <vector>
+
+
+// Process-wide counters and latency histograms exported in Prometheus text format on /metrics. Every thread
+// updates its own block, so an update is a plain load and store without contention, and a scrape sums the blocks.
+// Blocks of finished threads are handed to new ones, so no counts are lost and their number stays bounded.
+namespace telemetry {
+    enum Counter : size_t {
+        kQueries,
+        kCacheHits,
+        kCacheMisses,
+        kTruncatedQueries,
+        kNodesVisited,
+        kMetricEvaluations,
+        kSubtreesPruned,
+        kResults,
+        kParseMicroseconds,
+        kSearchMicroseconds,
+        kSerializeMicroseconds,
+        kQueueWaitMicroseconds,
+        kCountersCount
+    };
+
+    enum Histogram : size_t {
+        kRequestDuration,
+        kSearchWalkDuration,
+        kQueueWait,
+        kHistogramsCount
+    };
+
+    struct Description {
+        const char* name;
+        const char* help;
+        // counters of microseconds are exported in seconds
+        bool is_time;
+    };
+
+    constexpr Description kCounters[kCountersCount] = {
+        {"corrector_queries_total", "Queries served, from the cache included", false},
+        {"corrector_cache_hits_total", "Queries served from the result cache", false},
+        {"corrector_cache_misses_total", "Queries searched in the tree", false},
+        {"corrector_truncated_queries_total", "Queries stopped by their deadline or nodes limit", false},
+        {"corrector_nodes_visited_total", "Tree nodes visited by searches", false},
+        {"corrector_metric_evaluations_total", "Distances computed by searches", false},
+        {"corrector_subtrees_pruned_total", "Subtrees skipped by searches", false},
+        {"corrector_results_total", "Results returned by searches", false},
+        {"corrector_parse_seconds_total", "Time spent reading and parsing requests", true},
+        {"corrector_search_seconds_total", "Time spent searching the tree", true},
+        {"corrector_serialize_seconds_total", "Time spent writing responses", true},
+        {"corrector_queue_wait_seconds_total", "Time chunks of batches waited for a pool thread", true},
+    };
+
+    constexpr Description kHistograms[kHistogramsCount] = {
+        {"corrector_request_duration_seconds", "Duration of /correct requests and binary batches", true},
+        {"corrector_search_walk_duration_seconds", "Duration of a tree walk searching a chunk of queries together",
+                true},
+        {"corrector_queue_wait_seconds", "Time a chunk of a batch waited for a pool thread", true},
+    };
+
+    // upper bounds of histogram buckets in microseconds, the last bucket is unbounded
+    constexpr uint64_t kBucketBounds[] = {
+        50, 100, 250, 500, 1000, 2500, 5000, 10000, 25000, 50000, 100000, 250000, 500000, 1000000, 2500000, 10000000
+    };
+    constexpr size_t kBucketsCount = sizeof(kBucketBounds) / sizeof(kBucketBounds[0]) + 1;
+
+    // Written by the owning thread only, relaxed atomics let scrapes read them concurrently.
+    struct ThreadBlock {
+        std::atomic<uint64_t> counters[kCountersCount] = {};
+        std::atomic<uint64_t> buckets[kHistogramsCount][kBucketsCount] = {};
+        std::atomic<uint64_t> sums[kHistogramsCount] = {};
+    };
+
+    class Registry {
+    public:
+        // never destroyed, so threads finishing during exit can still return their blocks
+        static Registry& Instance() {
+            static auto registry = new Registry();
+            return *registry;
+        }
+
+        ThreadBlock* Acquire() {
+            std::lock_guard<std::mutex> lock(mutex_);
+            if (!free_blocks_.empty()) {
+                ThreadBlock* block = free_blocks_.back();
+                free_blocks_.pop_back();
+                return block;
+            }
+            blocks_.push_back(std::make_unique<ThreadBlock>());
+            return blocks_.back().get();
+        }
+
+        void Release(ThreadBlock* block) {
+            std::lock_guard<std::mutex> lock(mutex_);
+            free_blocks_.push_back(block);
+        }
+
+        void WritePrometheus(std::ostream& output) {
+            uint64_t counters[kCountersCount] = {};
+            uint64_t buckets[kHistogramsCount][kBucketsCount] = {};
+            uint64_t sums[kHistogramsCount] = {};
+            {
+                std::lock_guard<std::mutex> lock(mutex_);
+                for (const auto& block: blocks_) {
+                    for (size_t counter = 0; counter < kCountersCount; ++counter) {
+                        counters[counter] += block->counters[counter].load(std::memory_order_relaxed);
+                    }
+                    for (size_t histogram = 0; histogram < kHistogramsCount; ++histogram) {
+                        for (size_t bucket = 0; bucket < kBucketsCount; ++bucket) {
+                            buckets[histogram][bucket] += block->buckets[histogram][bucket].load(
+                                    std::memory_order_relaxed);
+                        }
+                        sums[histogram] += block->sums[histogram].load(std::memory_order_relaxed);
+                    }
+                }
+            }
+
+            for (size_t counter = 0; counter < kCountersCount; ++counter) {
+                const Description& description = kCounters[counter];
+                output << "# HELP " << description.name << ' ' << description.help << '\n';
+                output << "# TYPE " << description.name << " counter\n";
+                output << description.name << ' ';
+                write_value(output, counters[counter], description.is_time);
+                output << '\n';
+            }
+            for (size_t histogram = 0; histogram < kHistogramsCount; ++histogram) {
+                const Description& description = kHistograms[histogram];
+                output << "# HELP " << description.name << ' ' << description.help << '\n';
+                output << "# TYPE " << description.name << " histogram\n";
+                uint64_t cumulative = 0;
+                for (size_t bucket = 0; bucket < kBucketsCount; ++bucket) {
+                    cumulative += buckets[histogram][bucket];
+                    output << description.name << "_bucket{le=\"";
+                    if (bucket + 1 < kBucketsCount) {
+                        write_value(output, kBucketBounds[bucket], true);
+                    } else {
+                        output << "+Inf";
+                    }
+                    output << "\"} " << cumulative << '\n';
+                }
+                output << description.name << "_sum ";
+                write_value(output, sums[histogram], true);
+                output << '\n' << description.name << "_count " << cumulative << '\n';
+            }
+        }
+
+    private:
+        Registry() = default;
+
+        static void write_value(std::ostream& output, uint64_t value, bool is_time) {
+            if (!is_time) {
+                output << value;
+                return;
+            }
+            // fixed point keeps the exact value without locale or precision surprises
+            uint64_t fraction = value % 1000000;
+            output << value / 1000000 << '.';
+            for (uint64_t divisor = 100000; divisor != 0; divisor /= 10) {
+                output << static_cast<char>('0' + fraction / divisor % 10);
+            }
+        }
+
+        std::mutex mutex_;
+        std::vector<std::unique_ptr<ThreadBlock>> blocks_;
+        std::vector<ThreadBlock*> free_blocks_;
+    };
+
+    inline ThreadBlock& Local() {
+        struct Slot {
+            ThreadBlock* block = Registry::Instance().Acquire();
+
+            ~Slot() {
+                Registry::Instance().Release(block);
+            }
+        };
+        static thread_local Slot slot;
+        return *slot.block;
+    }
+
+    inline void Increment(std::atomic<uint64_t>& cell, uint64_t value) {
+        cell.store(cell.load(std::memory_order_relaxed) + value, std::memory_order_relaxed);
+    }
+
+    inline void Add(Counter counter, uint64_t value) {
+        Increment(Local().counters[counter], value);
+    }
+
+    inline void Observe(Histogram histogram, uint64_t microseconds) {
+        size_t bucket = 0;
+        while (bucket + 1 < kBucketsCount && microseconds > kBucketBounds[bucket]) {
+            ++bucket;
+        }
+        ThreadBlock& block = Local();
+        Increment(block.buckets[histogram][bucket], 1);
+        Increment(block.sums[histogram], microseconds);
+    }
+
+    using Clock = std::chrono::steady_clock;
+
+    inline uint64_t MicrosecondsSince(Clock::time_point start) {
+        return static_cast<uint64_t>(
+                std::chrono::duration_cast<std::chrono::microseconds>(Clock::now() - start).count());
+    }
+}
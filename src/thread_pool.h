@@ -0,0 +1,180 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+
+// Fixed set of workers with a task queue each. Workers take their own tasks from the back and steal from the front
+// of other queues when theirs is empty, so the load evens out without one contended queue.
+class ThreadPool {
+public:
+    using Task = std::function<void()>;
+
+    explicit ThreadPool(size_t threads_count) : queues_(std::max<size_t>(1, threads_count)) {
+        for (size_t index = 0; index < queues_.size(); ++index) {
+            workers_.emplace_back(&ThreadPool::run_worker, this, index);
+        }
+    }
+
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+
+    ~ThreadPool() {
+        {
+            std::lock_guard<std::mutex> lock(sleep_mutex_);
+            is_stopping_ = true;
+        }
+        wake_up_.notify_all();
+        for (auto& worker: workers_) {
+            worker.join();
+        }
+    }
+
+    [[nodiscard]] size_t Size() const {
+        return workers_.size();
+    }
+
+    // Calls body(begin, end) for chunks of [0, count) of the given size and returns when all of them are done,
+    // rethrowing the first exception thrown by body. The first chunk runs on the calling thread, which then helps
+    // the workers, so a single chunk never leaves it. Nested calls from within body are fine.
+    void ParallelFor(size_t count, size_t chunk_size, const std::function<void(size_t, size_t)>& body) {
+        chunk_size = std::max<size_t>(1, chunk_size);
+        size_t chunks_count = (count + chunk_size - 1) / chunk_size;
+        if (chunks_count <= 1) {
+            if (count != 0) {
+                body(0, count);
+            }
+            return;
+        }
+
+        std::mutex batch_mutex;
+        std::condition_variable batch_done;
+        size_t remaining = chunks_count;
+        std::exception_ptr error;
+        auto run_chunk = [&](size_t chunk) {
+            std::exception_ptr chunk_error;
+            try {
+                body(chunk * chunk_size, std::min(count, (chunk + 1) * chunk_size));
+            } catch (...) {
+                chunk_error = std::current_exception();
+            }
+            std::lock_guard<std::mutex> lock(batch_mutex);
+            if (chunk_error && !error) {
+                error = chunk_error;
+            }
+            if (--remaining == 0) {
+                batch_done.notify_all();
+            }
+        };
+        for (size_t chunk = 1; chunk < chunks_count; ++chunk) {
+            push([&run_chunk, chunk]() {
+                run_chunk(chunk);
+            });
+        }
+        run_chunk(0);
+
+        while (true) {
+            {
+                std::unique_lock<std::mutex> lock(batch_mutex);
+                if (remaining == 0) {
+                    break;
+                }
+            }
+            Task task;
+            if (try_pop(queues_.size(), task)) {
+                task();
+                continue;
+            }
+            // every chunk left is already taken by a worker
+            std::unique_lock<std::mutex> lock(batch_mutex);
+            batch_done.wait(lock, [&remaining]() {
+                return remaining == 0;
+            });
+            break;
+        }
+        if (error) {
+            std::rethrow_exception(error);
+        }
+    }
+
+private:
+    struct Queue {
+        std::mutex mutex;
+        std::deque<Task> tasks;
+    };
+
+    void push(Task task) {
+        // counted before it's queued, so pending_ never drops below the number of queued tasks
+        {
+            std::lock_guard<std::mutex> lock(sleep_mutex_);
+            ++pending_;
+        }
+        Queue& queue = queues_[next_queue_.fetch_add(1, std::memory_order_relaxed) % queues_.size()];
+        {
+            std::lock_guard<std::mutex> lock(queue.mutex);
+            queue.tasks.push_back(std::move(task));
+        }
+        wake_up_.notify_one();
+    }
+
+    // Takes a task from the back of the own queue or steals one from the front of another queue.
+    // Threads outside the pool pass an index past the last queue and only steal.
+    bool try_pop(size_t own_index, Task& task) {
+        if (pending_.load() == 0) {
+            return false;
+        }
+        if (own_index < queues_.size()) {
+            Queue& queue = queues_[own_index];
+            std::lock_guard<std::mutex> lock(queue.mutex);
+            if (!queue.tasks.empty()) {
+                task = std::move(queue.tasks.back());
+                queue.tasks.pop_back();
+                --pending_;
+                return true;
+            }
+        }
+        for (size_t shift = 1; shift <= queues_.size(); ++shift) {
+            Queue& queue = queues_[(own_index + shift) % queues_.size()];
+            std::lock_guard<std::mutex> lock(queue.mutex);
+            if (!queue.tasks.empty()) {
+                task = std::move(queue.tasks.front());
+                queue.tasks.pop_front();
+                --pending_;
+                return true;
+            }
+        }
+        return false;
+    }
+
+    void run_worker(size_t index) {
+        while (true) {
+            Task task;
+            if (try_pop(index, task)) {
+                task();
+                continue;
+            }
+            std::unique_lock<std::mutex> lock(sleep_mutex_);
+            wake_up_.wait(lock, [this]() {
+                return is_stopping_ || pending_.load() != 0;
+            });
+            if (is_stopping_ && pending_.load() == 0) {
+                return;
+            }
+        }
+    }
+
+    std::vector<Queue> queues_;
+    std::vector<std::thread> workers_;
+    std::atomic<size_t> next_queue_{0};
+    std::atomic<size_t> pending_{0};
+    std::mutex sleep_mutex_;
+    std::condition_variable wake_up_;
+    bool is_stopping_ = false;
+};
@@ -0,0 +1,150 @@
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+
+
+// UTF-8 conversion at the edges of the service, words are stored as UTF-32 in std::wstring. Runs of ASCII are
+// checked and widened eight bytes at a time, other sequences are validated strictly: overlong forms, surrogates
+// and code points past U+10FFFF are rejected.
+namespace utf8 {
+    static_assert(sizeof(wchar_t) == 4, "words are stored as UTF-32");
+
+    constexpr uint64_t kHighBits = 0x8080808080808080ull;
+
+    // Replaces the contents of output with decoded text, returns false if the input is not valid UTF-8.
+    inline bool Decode(std::string_view input, std::wstring& output) {
+        // never more code points than bytes
+        output.resize(input.size());
+        auto in = reinterpret_cast<const unsigned char*>(input.data());
+        auto in_end = in + input.size();
+        wchar_t* out = output.data();
+        while (in < in_end) {
+            if (in_end - in >= 8) {
+                uint64_t block;
+                std::memcpy(&block, in, sizeof(block));
+                if ((block & kHighBits) == 0) {
+                    for (int index = 0; index < 8; ++index) {
+                        out[index] = static_cast<wchar_t>(in[index]);
+                    }
+                    in += 8;
+                    out += 8;
+                    continue;
+                }
+            }
+            uint32_t lead = *in;
+            if (lead < 0x80) {
+                *out++ = static_cast<wchar_t>(lead);
+                ++in;
+                continue;
+            }
+            // two-byte sequences cover Cyrillic and most other alphabets of the dictionaries
+            if (lead >= 0xC2 && lead < 0xE0 && in_end - in >= 2 && (in[1] & 0xC0) == 0x80) {
+                *out++ = static_cast<wchar_t>(((lead & 0x1F) << 6) | (in[1] & 0x3F));
+                in += 2;
+                continue;
+            }
+            size_t length;
+            uint32_t code_point, min_code_point;
+            if ((lead & 0xE0) == 0xC0) {
+                length = 2;
+                code_point = lead & 0x1F;
+                min_code_point = 0x80;
+            } else if ((lead & 0xF0) == 0xE0) {
+                length = 3;
+                code_point = lead & 0x0F;
+                min_code_point = 0x800;
+            } else if ((lead & 0xF8) == 0xF0) {
+                length = 4;
+                code_point = lead & 0x07;
+                min_code_point = 0x10000;
+            } else {
+                return false;
+            }
+            if (static_cast<size_t>(in_end - in) < length) {
+                return false;
+            }
+            for (size_t index = 1; index < length; ++index) {
+                if ((in[index] & 0xC0) != 0x80) {
+                    return false;
+                }
+                code_point = (code_point << 6) | (in[index] & 0x3F);
+            }
+            if (code_point < min_code_point || code_point > 0x10FFFF || (code_point >= 0xD800 && code_point < 0xE000)) {
+                return false;
+            }
+            *out++ = static_cast<wchar_t>(code_point);
+            in += length;
+        }
+        output.resize(static_cast<size_t>(out - output.data()));
+        return true;
+    }
+
+    // Replaces the contents of output with encoded text, returns false if the input has invalid code points.
+    inline bool Encode(std::wstring_view input, std::string& output) {
+        output.resize(input.size() * 4);
+        auto out = reinterpret_cast<unsigned char*>(output.data());
+        const wchar_t* in = input.data();
+        const wchar_t* in_end = in + input.size();
+        while (in < in_end) {
+            if (in_end - in >= 8) {
+                uint32_t any_wide = 0;
+                for (int index = 0; index < 8; ++index) {
+                    any_wide |= static_cast<uint32_t>(in[index]);
+                }
+                if (any_wide < 0x80) {
+                    for (int index = 0; index < 8; ++index) {
+                        out[index] = static_cast<unsigned char>(in[index]);
+                    }
+                    in += 8;
+                    out += 8;
+                    continue;
+                }
+            }
+            auto code_point = static_cast<uint32_t>(*in++);
+            if (code_point < 0x80) {
+                *out++ = static_cast<unsigned char>(code_point);
+            } else if (code_point < 0x800) {
+                *out++ = static_cast<unsigned char>(0xC0 | (code_point >> 6));
+                *out++ = static_cast<unsigned char>(0x80 | (code_point & 0x3F));
+            } else if (code_point < 0x10000) {
+                if (code_point >= 0xD800 && code_point < 0xE000) {
+                    return false;
+                }
+                *out++ = static_cast<unsigned char>(0xE0 | (code_point >> 12));
+                *out++ = static_cast<unsigned char>(0x80 | ((code_point >> 6) & 0x3F));
+                *out++ = static_cast<unsigned char>(0x80 | (code_point & 0x3F));
+            } else if (code_point <= 0x10FFFF) {
+                *out++ = static_cast<unsigned char>(0xF0 | (code_point >> 18));
+                *out++ = static_cast<unsigned char>(0x80 | ((code_point >> 12) & 0x3F));
+                *out++ = static_cast<unsigned char>(0x80 | ((code_point >> 6) & 0x3F));
+                *out++ = static_cast<unsigned char>(0x80 | (code_point & 0x3F));
+            } else {
+                return false;
+            }
+        }
+        output.resize(static_cast<size_t>(out - reinterpret_cast<unsigned char*>(output.data())));
+        return true;
+    }
+
+    // Throwing versions for call sites without a buffer to reuse. std::range_error is what std::wstring_convert
+    // used to throw, so the existing handlers keep working.
+    inline std::wstring Decode(std::string_view input) {
+        std::wstring output;
+        if (!Decode(input, output)) {
+            throw std::range_error("Invalid UTF-8 string");
+        }
+        return output;
+    }
+
+    inline std::string Encode(std::wstring_view input) {
+        std::string output;
+        if (!Encode(input, output)) {
+            throw std::range_error("Invalid code point in string");
+        }
+        return output;
+    }
+}
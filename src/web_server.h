@@ -4,10 +4,8 @@
 #include <iterator>
 #include <memory>
 #include <fstream>
-#include <codecvt>
 #include <memory>
 #include <chrono>
-#include <locale>
 
 #include <Poco/String.h>
 #include <Poco/Format.h>
@@ -26,7 +24,12 @@
 #include <Poco/Net/HTTPServerRequest.h>
 #include <Poco/Net/HTTPServerResponse.h>
 
-#include "bk_tree.hpp"
+#include "search_executor.h"
+#include "admission_control.h"
+#include "connection_limit.h"
+#include "json_stream.h"
+#include "utf8.h"
+#include "telemetry.h"
 
 using namespace Poco::JSON;
 using namespace Poco::Net;
@@ -34,8 +37,172 @@ using namespace Poco::Util;
 
 class CorrectorHTTPRequestsHandler : public HTTPRequestHandler {
 public:
-    explicit CorrectorHTTPRequestsHandler(std::shared_ptr<BKTree> dictionary)
-        : HTTPRequestHandler(), dictionary_(std::move(dictionary)), parser_() {
+    CorrectorHTTPRequestsHandler(std::shared_ptr<SearchExecutor> search_executor, AdmissionControl::Ticket ticket)
+        : HTTPRequestHandler(), search_executor_(std::move(search_executor)),
+          dictionaries_(search_executor_->Dictionaries()), ticket_(std::move(ticket)) {
+    }
+
+    // Reads the request array and writes the response in windows of kWindowSize elements, so memory doesn't grow
+    // with the batch. Malformed input found before the response has started yields 400 Bad Request.
+    void handleRequest(HTTPServerRequest& http_request, HTTPServerResponse& http_response) override {
+        auto request_start = telemetry::Clock::now();
+        auto snapshot = search_executor_->TakeSnapshot();
+        JsonStreamReader reader(http_request.stream());
+        std::unique_ptr<JsonStreamWriter> writer;
+        std::vector<SearchQuery> queries;
+        std::vector<uint32_t> dictionaries;
+        bool has_more = true;
+        try {
+            reader.BeginArray();
+            while (has_more) {
+                queries.clear();
+                dictionaries.clear();
+                auto parse_start = telemetry::Clock::now();
+                while (queries.size() < kWindowSize && (has_more = reader.NextElement())) {
+                    dictionaries.push_back(dictionaries_->DefaultIndex());
+                    queries.push_back(read_query(reader, dictionaries.back()));
+                }
+                telemetry::Add(telemetry::kParseMicroseconds, telemetry::MicrosecondsSince(parse_start));
+                if (writer == nullptr) {
+                    http_response.setStatus(HTTPServerResponse::HTTP_OK);
+                    http_response.setContentType("application/json");
+                    http_response.setChunkedTransferEncoding(true);
+                    writer = std::make_unique<JsonStreamWriter>(http_response.send());
+                    writer->BeginArray();
+                }
+                auto window = search_executor_->Search(snapshot, queries, dictionaries);
+                auto serialize_start = telemetry::Clock::now();
+                write_results(queries, window, *writer);
+                telemetry::Add(telemetry::kSerializeMicroseconds, telemetry::MicrosecondsSince(serialize_start));
+            }
+            writer->EndArray();
+        } catch (std::exception& e) {
+            if (writer != nullptr) {
+                throw;
+            }
+            http_response.setStatus(HTTPServerResponse::HTTP_BAD_REQUEST);
+            http_response.setContentType("application/json");
+            JsonStreamWriter error_writer(http_response.send());
+            error_writer.BeginObject();
+            error_writer.Key("error");
+            error_writer.String(e.what());
+            error_writer.EndObject();
+        }
+        telemetry::Observe(telemetry::kRequestDuration, telemetry::MicrosecondsSince(request_start));
+    }
+
+private:
+    static constexpr size_t kWindowSize = 8 * SearchExecutor::kChunkSize;
+
+    // The dictionary is the one named by the optional "dictionary" key, or is left as passed.
+    SearchQuery read_query(JsonStreamReader& reader, uint32_t& dictionary) {
+        SearchQuery query{L"", 0, 0};
+        bool has_candidate = false, has_tolerance = false;
+        std::string key;
+        reader.BeginObject();
+        while (reader.NextKey(key)) {
+            if (key == "candidate") {
+                query.word = utf8::Decode(reader.ReadString());
+                has_candidate = true;
+            } else if (key == "max_tolerance") {
+                query.tolerance = static_cast<uint32_t>(std::min<uint64_t>(reader.ReadUnsigned(),
+                        std::numeric_limits<uint32_t>::max()));
+                has_tolerance = true;
+            } else if (key == "limit") {
+                query.limit = reader.ReadUnsigned();
+            } else if (key == "deadline_ms") {
+                query.deadline_ms = reader.ReadUnsigned();
+            } else if (key == "max_nodes_visited") {
+                query.max_nodes_visited = reader.ReadUnsigned();
+            } else if (key == "dictionary") {
+                dictionary = dictionaries_->Resolve(reader.ReadString());
+            } else {
+                reader.SkipValue();
+            }
+        }
+        if (!has_candidate || !has_tolerance) {
+            throw std::runtime_error("Every request must have \"candidate\" and \"max_tolerance\"");
+        }
+        return query;
+    }
+
+    // Keys are written in alphabetical order, as the document based serialization used to do.
+    void write_results(const std::vector<SearchQuery>& queries, const SearchExecutor::Results& window,
+            JsonStreamWriter& writer) {
+        for (size_t index = 0; index < queries.size(); ++index) {
+            writer.BeginObject();
+            writer.Key("microseconds");
+            writer.Number(window.microseconds[index]);
+            writer.Key("milliseconds");
+            writer.Number(window.microseconds[index] / 1000);
+            writer.Key("results");
+            writer.BeginArray();
+            for (const auto& elem: *window.results[index]) {
+                writer.BeginObject();
+                writer.Key("priority");
+                writer.Number(elem.priority);
+                writer.Key("tolerance");
+                writer.Number(elem.tolerance);
+                writer.Key("word");
+                write_word(elem.result, writer);
+                writer.EndObject();
+            }
+            writer.EndArray();
+            writer.Key("tolerance");
+            writer.Number(queries[index].tolerance);
+            writer.Key("truncated");
+            writer.Bool(window.truncated[index] != 0);
+            writer.Key("word");
+            write_word(queries[index].word, writer);
+            writer.EndObject();
+        }
+    }
+
+    // encodes into a buffer reused for all the words of the response
+    void write_word(std::wstring_view word, JsonStreamWriter& writer) {
+        if (!utf8::Encode(word, encoded_word_)) {
+            throw std::range_error("Invalid code point in string");
+        }
+        writer.String(encoded_word_);
+    }
+
+    std::shared_ptr<SearchExecutor> search_executor_;
+    std::shared_ptr<DictionaryRegistry> dictionaries_;
+    AdmissionControl::Ticket ticket_;
+    std::string encoded_word_;
+};
+
+
+// Answers search requests past the admission limit, clients are expected to retry later or elsewhere.
+class OverloadedHandler : public HTTPRequestHandler {
+public:
+    void handleRequest(HTTPServerRequest&, HTTPServerResponse& http_response) override {
+        http_response.setStatus(HTTPServerResponse::HTTP_SERVICE_UNAVAILABLE);
+        http_response.set("Retry-After", "1");
+        http_response.setContentType("application/json");
+        JsonStreamWriter writer(http_response.send());
+        writer.BeginObject();
+        writer.Key("error");
+        writer.String("Too many requests in flight");
+        writer.EndObject();
+    }
+};
+
+
+// Handles /insert, /increase_priority and /delete. Every request is an array of
+// {"word": ..., "priority": ..., "dictionary": ...}, priority defaults to 1 and is ignored by /delete, dictionary
+// defaults to the default one. Updates are applied to the current generation of the dictionary and are lost when
+// it's reloaded.
+class DictionaryUpdateHandler : public HTTPRequestHandler {
+public:
+    enum class Operation {
+        kInsert,
+        kIncreasePriority,
+        kDelete
+    };
+
+    DictionaryUpdateHandler(std::shared_ptr<DictionaryRegistry> dictionaries, Operation operation)
+        : HTTPRequestHandler(), dictionaries_(std::move(dictionaries)), operation_(operation), parser_() {
     }
 
     void handleRequest(HTTPServerRequest& http_request, HTTPServerResponse& http_response) override {
@@ -43,65 +210,212 @@ public:
         Array::Ptr requests_array = parser_.parse(request_stream).extract<Array::Ptr>();
         Array::Ptr response_array = Poco::SharedPtr(new Array());
         for (size_t index = 0; index < requests_array->size(); ++index) {
-            auto start_time = std::chrono::high_resolution_clock::now();
-
             auto request = requests_array->getObject(index);
-            auto request_word_bytes = request->getValue<std::string>("candidate");
-            auto request_tolerance = request->getValue<uint32_t>("max_tolerance");
-            std::wstring request_word = converter_.from_bytes(request_word_bytes);
-
-            auto search_result = dictionary_->FindSimilar(request_word, request_tolerance);
-            auto search_result_array = Array();
-            for (const auto& elem: search_result) {
-                auto json_object = Object();
-                json_object.set("word", converter_.to_bytes(elem.result));
-                json_object.set("tolerance", elem.tolerance);
-                json_object.set("priority", elem.priority);
-                search_result_array.add(json_object);
-            }
+            uint32_t dictionary_index = dictionaries_->Resolve(
+                    request->has("dictionary") ? request->getValue<std::string>("dictionary") : "");
+            auto dictionary = dictionaries_->Holder(dictionary_index)->Get();
+            std::wstring word = utf8::Decode(request->getValue<std::string>("word"));
+            Poco::toLowerInPlace(word);
+            auto priority = request->has("priority") ? request->getValue<uint32_t>("priority") : 1u;
 
-            auto finish_time = std::chrono::high_resolution_clock::now();
+            std::string status;
+            switch (operation_) {
+                case Operation::kInsert:
+                    status = dictionary->Insert(word, priority) ? "inserted" : "updated";
+                    break;
+                case Operation::kIncreasePriority:
+                    status = dictionary->IncreasePriority(word, priority) ? "updated" : "not_found";
+                    break;
+                case Operation::kDelete:
+                    status = dictionary->Delete(word) ? "deleted" : "not_found";
+                    break;
+            }
 
             auto json_response = Object();
-            json_response.set("word", converter_.to_bytes(request_word));
-            json_response.set("tolerance", request_tolerance);
-            json_response.set("results", search_result_array);
-            json_response.set("milliseconds",
-                    std::chrono::duration_cast<std::chrono::milliseconds>(finish_time - start_time).count());
-
+            json_response.set("word", utf8::Encode(word));
+            json_response.set("status", status);
             response_array->set(index, json_response);
         }
 
-        response_array->stringify(http_response.send(), 4);
         http_response.setStatus(HTTPServerResponse::HTTP_OK);
+        response_array->stringify(http_response.send(), 4);
     }
 
 private:
-    std::shared_ptr<BKTree> dictionary_;
+    std::shared_ptr<DictionaryRegistry> dictionaries_;
+    Operation operation_;
     Poco::JSON::Parser parser_;
-    std::wstring_convert<std::codecvt_utf8<wchar_t>> converter_;
+};
+
+
+// Handles /reload: loads all dictionaries and their metrics anew and swaps them with the ones being served.
+// Responds with the outcome for every dictionary: 500 if some of them failed, 409 if all of them were being
+// reloaded already, 200 otherwise.
+class ReloadHandler : public HTTPRequestHandler {
+public:
+    explicit ReloadHandler(std::shared_ptr<DictionaryRegistry> dictionaries)
+        : HTTPRequestHandler(), dictionaries_(std::move(dictionaries)) {
+    }
+
+    void handleRequest(HTTPServerRequest&, HTTPServerResponse& http_response) override {
+        using ReloadStatus = DictionaryRegistry::ReloadStatus;
+        auto outcomes = dictionaries_->Reload();
+        bool is_failed = false, is_reloaded = false;
+        auto dictionaries_response = Object();
+        for (uint32_t index = 0; index < dictionaries_->Size(); ++index) {
+            auto dictionary_response = Object();
+            dictionary_response.set("status", DictionaryRegistry::StatusName(outcomes[index].status));
+            dictionary_response.set("generation", dictionaries_->Holder(index)->Generation());
+            if (outcomes[index].status == ReloadStatus::kFailed) {
+                dictionary_response.set("error", outcomes[index].error);
+            }
+            dictionaries_response.set(dictionaries_->Name(index), dictionary_response);
+            is_failed = is_failed || outcomes[index].status == ReloadStatus::kFailed;
+            is_reloaded = is_reloaded || outcomes[index].status == ReloadStatus::kReloaded;
+        }
+
+        auto json_response = Object();
+        if (is_failed) {
+            http_response.setStatus(HTTPServerResponse::HTTP_INTERNAL_SERVER_ERROR);
+            json_response.set("status", "failed");
+        } else if (!is_reloaded) {
+            http_response.setStatus(HTTPServerResponse::HTTP_CONFLICT);
+            json_response.set("status", "in_progress");
+        } else {
+            http_response.setStatus(HTTPServerResponse::HTTP_OK);
+            json_response.set("status", "reloaded");
+        }
+        json_response.set("generation", dictionaries_->Holder(dictionaries_->DefaultIndex())->Generation());
+        json_response.set("dictionaries", dictionaries_response);
+        json_response.stringify(http_response.send(), 4);
+    }
+
+private:
+    std::shared_ptr<DictionaryRegistry> dictionaries_;
+};
+
+
+// Handles GET /stats: dictionary generations and versions, result cache and admission counters. Top level generation
+// and version are the ones of the default dictionary.
+class StatsHandler : public HTTPRequestHandler {
+public:
+    StatsHandler(std::shared_ptr<DictionaryRegistry> dictionaries, std::shared_ptr<SearchCache> cache,
+            std::shared_ptr<AdmissionControl> admission_control, Poco::AutoPtr<ConnectionLimit> connection_limit)
+        : HTTPRequestHandler(), dictionaries_(std::move(dictionaries)), cache_(std::move(cache)),
+          admission_control_(std::move(admission_control)), connection_limit_(std::move(connection_limit)) {
+    }
+
+    void handleRequest(HTTPServerRequest&, HTTPServerResponse& http_response) override {
+        auto json_response = Object();
+        const auto& default_holder = dictionaries_->Holder(dictionaries_->DefaultIndex());
+        json_response.set("generation", default_holder->Generation());
+        json_response.set("version", default_holder->Get()->Version());
+        auto dictionaries_stats = Object();
+        for (uint32_t index = 0; index < dictionaries_->Size(); ++index) {
+            auto dictionary_stats = Object();
+            dictionary_stats.set("generation", dictionaries_->Holder(index)->Generation());
+            dictionary_stats.set("version", dictionaries_->Holder(index)->Get()->Version());
+            dictionaries_stats.set(dictionaries_->Name(index), dictionary_stats);
+        }
+        json_response.set("dictionaries", dictionaries_stats);
+        if (cache_ != nullptr) {
+            auto cache_stats = Object();
+            cache_stats.set("hits", cache_->Hits());
+            cache_stats.set("misses", cache_->Misses());
+            cache_stats.set("size", cache_->Size());
+            cache_stats.set("capacity", cache_->Capacity());
+            json_response.set("cache", cache_stats);
+        }
+        auto admission_stats = Object();
+        admission_stats.set("in_flight", admission_control_->InFlight());
+        admission_stats.set("limit", admission_control_->Limit());
+        admission_stats.set("rejected", admission_control_->Rejected());
+        admission_stats.set("rejected_connections", connection_limit_->Rejected());
+        json_response.set("admission", admission_stats);
+        http_response.setStatus(HTTPServerResponse::HTTP_OK);
+        json_response.stringify(http_response.send(), 4);
+    }
+
+private:
+    std::shared_ptr<DictionaryRegistry> dictionaries_;
+    std::shared_ptr<SearchCache> cache_;
+    std::shared_ptr<AdmissionControl> admission_control_;
+    Poco::AutoPtr<ConnectionLimit> connection_limit_;
+};
+
+
+// Handles GET /metrics: search counters and latency histograms in Prometheus text format.
+class MetricsHandler : public HTTPRequestHandler {
+public:
+    void handleRequest(HTTPServerRequest&, HTTPServerResponse& http_response) override {
+        http_response.setStatus(HTTPServerResponse::HTTP_OK);
+        http_response.setContentType("text/plain; version=0.0.4");
+        telemetry::Registry::Instance().WritePrometheus(http_response.send());
+    }
 };
 
 
 class CorrectorHandlerFactory : public HTTPRequestHandlerFactory {
 public:
-    explicit CorrectorHandlerFactory(std::shared_ptr<BKTree> dictionary)
-        : HTTPRequestHandlerFactory(), dictionary_(std::move(dictionary)) {
+    CorrectorHandlerFactory(std::shared_ptr<SearchExecutor> search_executor,
+            std::shared_ptr<AdmissionControl> admission_control, Poco::AutoPtr<ConnectionLimit> connection_limit)
+        : HTTPRequestHandlerFactory(), search_executor_(std::move(search_executor)),
+          admission_control_(std::move(admission_control)), connection_limit_(std::move(connection_limit)) {
+    }
+
+    // Answer of ConnectionLimit to connections past the queue, sent before any request is read.
+    static std::string QueueFullResponse() {
+        std::string body = R"({"error": "Too many connections waiting"})";
+        return "HTTP/1.1 503 Service Unavailable\r\nRetry-After: 1\r\nContent-Type: application/json\r\n"
+               "Content-Length: " + std::to_string(body.size()) + "\r\nConnection: close\r\n\r\n" + body;
     }
 
     HTTPRequestHandler* createRequestHandler(
             const HTTPServerRequest& request) override {
+        // an idle keep-alive client would hold this thread while other connections wait for one
+        if (connection_limit_->IsSaturated()) {
+            request.response().setKeepAlive(false);
+        }
+
+        if (request.getMethod() == HTTPRequest::HTTP_GET && request.getURI() == "/stats") {
+            return new StatsHandler(search_executor_->Dictionaries(), search_executor_->Cache(), admission_control_,
+                    connection_limit_);
+        }
+        if (request.getMethod() == HTTPRequest::HTTP_GET && request.getURI() == "/metrics") {
+            return new MetricsHandler();
+        }
 
         if (request.getMethod() != HTTPRequest::HTTP_POST) {
             return nullptr;
         }
 
         if (request.getURI() == "/correct") {
-            return new CorrectorHTTPRequestsHandler(dictionary_);
+            AdmissionControl::Ticket ticket(admission_control_);
+            if (!ticket) {
+                return new OverloadedHandler();
+            }
+            return new CorrectorHTTPRequestsHandler(search_executor_, std::move(ticket));
+        }
+        if (request.getURI() == "/insert") {
+            return new DictionaryUpdateHandler(search_executor_->Dictionaries(),
+                    DictionaryUpdateHandler::Operation::kInsert);
+        }
+        if (request.getURI() == "/increase_priority") {
+            return new DictionaryUpdateHandler(search_executor_->Dictionaries(),
+                    DictionaryUpdateHandler::Operation::kIncreasePriority);
+        }
+        if (request.getURI() == "/delete") {
+            return new DictionaryUpdateHandler(search_executor_->Dictionaries(),
+                    DictionaryUpdateHandler::Operation::kDelete);
+        }
+        if (request.getURI() == "/reload") {
+            return new ReloadHandler(search_executor_->Dictionaries());
         }
 
         return nullptr;
     }
 private:
-    std::shared_ptr<BKTree> dictionary_;
+    std::shared_ptr<SearchExecutor> search_executor_;
+    std::shared_ptr<AdmissionControl> admission_control_;
+    Poco::AutoPtr<ConnectionLimit> connection_limit_;
 };